@@ -0,0 +1,2951 @@
+/***************************/
+/* libtyposee.c            */
+/*                         ***********************************************************************************************************/
+/* The matcher behind typosee, packaged for reuse; see typosee.h for the interface.                                                  */
+/*                                                                                                                                   */
+/* levenshtein_distance() is the original Wagner-Fischer implementation from typosee.c. The batch entry points take the labels of a  */
+/* sealed typosee_batch in length order, so for each keyword the labels whose lengths are within the threshold are one contiguous    */
+/* run, and push that run through Myers' bit-parallel distance several labels at a time, one label per vector lane. Packing the      */
+/* lanes in length order keeps labels of the same length together, so a vector rarely waits on one long label while the others       */
+/* idle; the workspace counts how many lane steps did useful work. Keywords longer than a machine word go through the                */
+/* Wagner-Fischer recurrence instead, confined to the diagonals that can still be within the threshold and abandoned once a row      */
+/* is past it. Either way only the pairs that match, and only when the caller wants edit scripts, pay for a full matrix (kept in     */
+/* the workspace) and its traceback, and the matches are handed out in label order.                                                  */
+/*                                                                                                                                   */
+/* Labels repeat a lot ("www", "mail", the same name under many hosts), so a batch hashes each label as it is added and sealing      */
+/* folds the repeats into their first copy, which alone goes through the kernel and hands its distance on. The same hash serves      */
+/* exact hits: the keywords are compiled into a minimal perfect hash (hash and displace), so below one edit a label costs a probe    */
+/* and a compare and no distance is computed at all.                                                                                 */
+/*                                                                                                                                   */
+/* Punycode labels ("xn--", spotted with one four-byte test as they are added) are decoded to code points and kept out of the        */
+/* byte path; each keyword is compared with them code point by code point, through the same banded recurrence, so a Cyrillic         */
+/* 'a' in "paypal" costs one edit rather than a string of ASCII noise.                                                               */
+/*                                                                                                                                   */
+/* In substring mode the kernel runs the same recurrence as an approximate search, with a free start in every column (Sellers), so a */
+/* keyword hidden in "paypal-secure-login" costs one pass over the label; only the matches are searched again, forwards and          */
+/* backwards, to find where the closest occurrence starts and ends.                                                                  */
+/*                                                                                                                                   */
+/* Transpositions, when asked for, ride in the same pass: Hyyro's extension adds one term to the kernel's diagonal vector, and the   */
+/* scalar recurrences keep one row more to reach back two cells.                                                                     */
+/*                                                                                                                                   */
+/* Edit costs give up the bit-parallel kernel, whose bit vectors can only count edits, for a weighted one on weights from a 256 x    */
+/* 256 table of tenths of an edit: a vector holds rows of one column of the recurrence, each label character brings a column of      */
+/* substitution costs built once per keyword, and the deletions that chain down the column are a prefix minimum of log2(rows)        */
+/* shifts. Keywords over 64 bytes and the portable build take the banded recurrence, as wide as the threshold buys the cheapest      */
+/* insertion or deletion. Without a cost table nothing changes, and the bit-parallel kernel stays the fast path.                     */
+/*                                                                                                                                   */
+/* With homoglyph matching on, every label of a batch is first folded to its confusables skeleton (0 -> o, rn -> m, Cyrillic and     */
+/* Greek lookalikes to Latin) and hashed once; a probe into the set's table of keyword skeletons finds the keywords it impersonates, */
+/* and those pairs are reported as their own class of match in place of whatever distance the kernels gave them.                     */
+/*                                                                                                                                   */
+/* Asked for the k nearest labels of a keyword, the matcher keeps them in a heap and, once it is full, holds the rest of the batch   */
+/* to the heap's worst distance instead of the threshold: the run of lengths to scan is cut down from both ends as the bound falls,  */
+/* and the banded recurrence narrows its band and gives up sooner. The k nearest keywords of a label take a heap per label instead,  */
+/* filled as the keywords go by.                                                                                                     */
+/*                                                                                                                                   */
+/* Keywords clustered with typosee_set_clusters() lean on the triangle inequality: a keyword whose anchor was matched earlier in the */
+/* block skips every label where the anchor's distance to the label and to the keyword differ by more than its threshold, so in a    */
+/* list of paypal lookalikes only the anchor pays for most of the labels that are far from all of them.                              */
+/*                                                                                                                                   */
+/* The kernel is built once per instruction set from libtyposee_kernel.h (scalar, SSE4.1, AVX2 and AVX-512, at 1, 2, 4 and 8         */
+/* lanes) and the widest one the CPU supports is picked at run time, so one binary serves the whole fleet. TYPOSEE_ISA=<name>        */
+/* or typosee_set_isa() pins a variant, which is handy for benchmarking them against each other.                                     */
+/*************************************************************************************************************************************/
+
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "typosee.h"
+
+#define MAX_LANES       8               /* labels per kernel pass at most: 8 x 64 bits, one AVX-512 register */
+#define CLUSTER_WINDOW  64              /* latest cluster leaders a keyword is compared with */
+#define TRI_UNKNOWN     0xff            /* no exact anchor distance kept for the label */
+
+#ifndef LABEL_HASH_MASK
+#define LABEL_HASH_MASK UINT64_MAX      /* tests build with a narrow one to make keywords' hashes collide */
+#endif
+
+struct typosee_set {
+    char *arena;                        /* every keyword, NUL-terminated, back to back */
+    size_t *off;
+    size_t *len;
+    uint32_t *cp;                       /* every keyword again as code points */
+    size_t *cp_off;
+    size_t *cp_len;
+    uint32_t *skel;                     /* and as confusables skeletons */
+    size_t *skel_off;
+    size_t *skel_len;
+    uint64_t *skel_hash;
+    uint32_t *skel_table;               /* open addressing on skel_hash: keyword + 1, 0 if free */
+    size_t skel_mask;
+    uint32_t *exact_seed;               /* minimal perfect hash of the distinct keywords: a displacement per bucket */
+    uint32_t *exact_key;                /* slot -> the first keyword with that text */
+    uint32_t *exact_next;               /* keyword -> the next one with the same text, UINT32_MAX after the last */
+    uint32_t exact_buckets;
+    uint32_t exact_slots;
+    uint32_t *limit;                    /* keyword thresholds of their own, UINT32_MAX if none; NULL until one is set */
+    uint32_t *anchor;                   /* clusters: an earlier keyword near this one, UINT32_MAX if none; NULL if not clustered */
+    uint8_t *anchor_dist;               /* and the distance between the two */
+    unsigned int count;
+    size_t bytes;
+};
+
+struct typosee_workspace {
+    edit *cells;                        /* (len1 + 1) x (len2 + 1) matrix, row-major */
+    size_t cells_cap;
+    edit **rows;
+    size_t rows_cap;
+    edit *script;
+    size_t script_cap;
+    uint64_t peq[256];                  /* bit i of peq[c] set when keyword[i] == c */
+    uint32_t *band;                     /* two rows of the banded recurrence for long keywords */
+    size_t band_cap;
+    void *lanes;                        /* the weighted kernel's keyword, profiles and columns, in vectors */
+    size_t lanes_cap;
+    uint8_t profiled[256];              /* label characters whose profile is built for the keyword */
+    uint32_t *hits;                     /* labels that matched the current keyword */
+    uint32_t *hit_dist;
+    size_t hits_cap;
+    const struct kernel *kernel;        /* ISA variant chosen when the workspace was made */
+    typosee_stats stats;
+    int timing;
+    int scripts;
+    int substring;
+    int osa;
+    const typosee_costs *costs;         /* NULL for unit costs */
+    int homoglyphs;
+    uint32_t *skel;                     /* a label's code points, then its skeleton */
+    size_t skel_cap;
+    uint64_t *glyphs;                   /* (keyword << 32 | label) of the block's skeleton collisions */
+    size_t nglyphs;
+    size_t glyphs_cap;
+    const uint64_t *glyph;              /* the current keyword's run of them */
+    size_t nglyph;
+    uint64_t *exacts;                   /* (keyword << 32 | label) of the block's exact hits, below one edit */
+    size_t nexacts;
+    size_t exacts_cap;
+    const uint64_t *exact;
+    uint8_t *tri;                       /* clusters: per anchor in the block, its distance to every label */
+    size_t tri_cap;
+    uint32_t *tri_slot;                 /* block keyword -> its row of tri, UINT32_MAX if it anchors no one there */
+    size_t tri_slot_cap;
+    uint8_t *tri_save;                  /* the current keyword's row to fill in, or NULL */
+    const uint8_t *tri_from;            /* its anchor's row to prune by, or NULL */
+    uint32_t tri_d;                     /* distance from the anchor */
+    int top;                            /* TYPOSEE_TOP_*, 0 for a plain threshold */
+    unsigned int top_k;
+    uint32_t bound;                     /* what the current keyword's labels are held to */
+    const unsigned int *bounds;         /* the caller's bound per keyword of the set, or NULL */
+    uint64_t *heap;                     /* TOP_LABELS: max-heap of the keyword's best (distance << 32 | label) */
+    size_t nheap;
+    size_t heap_cap;
+    uint64_t *label_heap;               /* TOP_KEYWORDS: top_k of (distance << 32 | keyword) per label */
+    uint32_t *label_nheap;
+    size_t label_cap;
+    uint64_t *picks;                    /* (keyword << 32 | label) of what the label heaps kept */
+    size_t npicks;
+    size_t picks_cap;
+    typosee_time mark;                  /* clocks at the last stage boundary */
+};
+
+/* One instruction-set variant of the kernel */
+struct kernel {
+    const char *name;
+    unsigned int lanes;
+    void (*myers[4])(typosee_workspace *ws, size_t m, const typosee_batch *b,
+            const uint32_t *idx, unsigned int n, uint32_t *dist);     /* [search | osa << 1] */
+    void (*weighted_keyword)(typosee_workspace *ws, const char *str1, size_t m);
+    void (*weighted[2])(typosee_workspace *ws, size_t m, const char *str2, size_t len2,
+            uint32_t k, uint32_t *distance);                            /* [osa] */
+};
+
+static const struct kernel *kernel_select(void);
+static int workspace_bounded(typosee_workspace *ws, const void *str1, size_t len1,
+        const void *str2, size_t len2, int wide, unsigned int k, unsigned int *distance);
+
+/* Edit costs in TYPOSEE_COST_UNITs; code points past 0xff cost the defaults */
+struct typosee_costs {
+    uint8_t sub[256][256];
+    uint8_t ins[256];
+    uint8_t del[256];
+    uint8_t sub_default;
+    uint8_t ins_default;
+    uint8_t del_default;
+    uint8_t swap;
+    uint8_t min_indel;                  /* cheapest insertion or deletion, which bounds the band */
+    uint8_t min_edit;                   /* cheapest edit but a swap; thresholds below it take exact hits only */
+};
+
+/* What an edit costs; NULL costs are unit costs, so the plain recurrence is one case of this */
+static inline unsigned int cost_sub(const typosee_costs *costs, uint32_t a, uint32_t b)
+{
+    return a == b ? 0 : !costs ? 1 : (a | b) < 256 ? costs->sub[a][b] : costs->sub_default;
+}
+
+static inline unsigned int cost_ins(const typosee_costs *costs, uint32_t c)
+{
+    return !costs ? 1 : c < 256 ? costs->ins[c] : costs->ins_default;
+}
+
+static inline unsigned int cost_del(const typosee_costs *costs, uint32_t c)
+{
+    return !costs ? 1 : c < 256 ? costs->del[c] : costs->del_default;
+}
+
+static int min3(int a, int b, int c)
+{
+    if (a <= b && a <= c) {
+        return a;
+    }
+    if (b <= c) {
+        return b;
+    }
+    return c;
+}
+ 
+/*
+ * With osa set, swapping two adjacent characters (optimal string alignment) is one
+ * edit too. costs weights the edits, NULL for one apiece.
+ */
+static unsigned int levenshtein_matrix_calculate(edit **mat, const char *str1, size_t len1,
+        const char *str2, size_t len2, int osa, const typosee_costs *costs)
+{
+    unsigned int i, j;
+    for (j = 1; j <= len2; j++) {
+        for (i = 1; i <= len1; i++) {
+            unsigned int substitution_cost;
+            unsigned int del = 0, ins = 0, subst = 0;
+            unsigned int best;
+            substitution_cost = cost_sub(costs, (unsigned char)str1[i - 1], (unsigned char)str2[j - 1]);
+            del = mat[i - 1][j].score + cost_del(costs, (unsigned char)str1[i - 1]); /* deletion */
+            ins = mat[i][j - 1].score + cost_ins(costs, (unsigned char)str2[j - 1]); /* insertion */
+            subst = mat[i - 1][j - 1].score + substitution_cost; /* substitution */
+            best = min3(del, ins, subst);
+            mat[i][j].score = best;                  
+            mat[i][j].arg1 = str1[i - 1];
+            mat[i][j].arg2 = str2[j - 1];
+            mat[i][j].pos = i - 1;
+            if (best == del) {
+                mat[i][j].type = DELETION;
+                mat[i][j].prev = &mat[i - 1][j];
+            }
+            else if (best == ins) {
+                mat[i][j].type = INSERTION;
+                mat[i][j].prev = &mat[i][j - 1];
+            }
+            else {
+                if (str1[i - 1] != str2[j - 1]) {
+                    mat[i][j].type = SUBSTITUTION;
+                }
+                else {
+                    mat[i][j].type = NONE;
+                }
+                mat[i][j].prev = &mat[i - 1][j - 1];
+            }
+            if (osa && i > 1 && j > 1 && str1[i - 1] == str2[j - 2] && str1[i - 2] == str2[j - 1]
+                    && mat[i - 2][j - 2].score + (costs ? costs->swap : 1) < best) {
+                mat[i][j].score = mat[i - 2][j - 2].score + (costs ? costs->swap : 1);
+                mat[i][j].type = TRANSPOSITION;
+                mat[i][j].arg1 = str1[i - 2];
+                mat[i][j].arg2 = str1[i - 1];
+                mat[i][j].pos = i - 2;
+                mat[i][j].prev = &mat[i - 2][j - 2];
+            }
+        }
+    }
+    return mat[len1][len2].score;
+}
+ 
+/* The borders chain back to [0][0] so a traceback that reaches them records the rest of the edits */
+static void levenshtein_matrix_borders(edit **mat, const char *str1, size_t len1, const char *str2,
+        size_t len2, const typosee_costs *costs)
+{
+    unsigned int i, j;
+
+    for (i = 0; i <= len1; i++) {
+        mat[i][0].score = i ? mat[i - 1][0].score + cost_del(costs, (unsigned char)str1[i - 1]) : 0;
+        mat[i][0].type = DELETION;
+        mat[i][0].prev = i ? &mat[i - 1][0] : NULL;
+        mat[i][0].arg1 = i ? str1[i - 1] : 0;
+        mat[i][0].arg2 = 0;
+        mat[i][0].pos = i ? i - 1 : 0;
+    }
+ 
+    for (j = 0; j <= len2; j++) {
+        mat[0][j].score = j ? mat[0][j - 1].score + cost_ins(costs, (unsigned char)str2[j - 1]) : 0;
+        mat[0][j].type = j ? INSERTION : NONE;
+        mat[0][j].prev = j ? &mat[0][j - 1] : NULL;
+        mat[0][j].arg1 = 0;
+        mat[0][j].arg2 = j ? str2[j - 1] : 0;
+        mat[0][j].pos = 0;
+    }
+}
+
+static edit **levenshtein_matrix_create(const char *str1, size_t len1, const char *str2,
+        size_t len2, const typosee_costs *costs)
+{
+    unsigned int i, j;
+    edit **mat = malloc((len1 + 1) * sizeof(edit *));
+    if (mat == NULL) {
+        return NULL;
+    }
+    for (i = 0; i <= len1; i++) {
+        mat[i] = malloc((len2 + 1) * sizeof(edit));
+        if (mat[i] == NULL) {
+            for (j = 0; j < i; j++) {
+                free(mat[j]);
+            }
+            free(mat);
+            return NULL;
+        }
+    }
+    levenshtein_matrix_borders(mat, str1, len1, str2, len2, costs);
+    return mat; 
+}
+ 
+/* Edits on the path to head; with unit costs that is its score */
+static unsigned int levenshtein_edits(const edit *head)
+{
+    unsigned int n = 0;
+
+    for (; head->prev != NULL; head = head->prev) {
+        n += head->type != NONE;
+    }
+    return n;
+}
+
+static void levenshtein_traceback(const edit *head, edit *script, unsigned int distance)
+{
+    unsigned int i = distance - 1;
+
+    for (; head->prev != NULL; head = head->prev) {
+        if (head->type != NONE) {
+            memcpy(script + i, head, sizeof(edit));
+            i--;
+        }
+    }
+}
+ 
+static unsigned int edit_distance(const char *str1, const char *str2, edit **script, unsigned int *edits,
+        int osa, const typosee_costs *costs)
+{
+    const size_t len1 = strlen(str1), len2 = strlen(str2);
+    unsigned int i, distance;
+    edit **mat;
+ 
+    /* If either string is empty, the distance is the other string's length (or the cost of it) */
+    *edits = 0;
+    if (len1 == 0 || len2 == 0) {
+        for (distance = 0, i = 0; i < len1; i++) {
+            distance += cost_del(costs, (unsigned char)str1[i]);
+        }
+        for (i = 0; i < len2; i++) {
+            distance += cost_ins(costs, (unsigned char)str2[i]);
+        }
+        return distance;
+    }
+    /* Initialise the matrix */
+    mat = levenshtein_matrix_create(str1, len1, str2, len2, costs);
+    if (!mat) {
+        *script = NULL;
+        return 0;
+    }
+    /* Main algorithm */
+    distance = levenshtein_matrix_calculate(mat, str1, len1, str2, len2, osa, costs);
+    /* Read back the edit script */
+    *edits = levenshtein_edits(&mat[len1][len2]);
+    *script = malloc(*edits * sizeof(edit));
+    if (*script) {
+        levenshtein_traceback(&mat[len1][len2], *script, *edits);
+    }
+    else {
+        distance = *edits = 0;
+    }
+    /* Clean up */
+    for (i = 0; i <= len1; i++) {
+        free(mat[i]);
+    }
+    free(mat);
+ 
+    return distance;
+}
+
+unsigned int levenshtein_distance(const char *str1, const char *str2, edit **script)
+{
+    unsigned int edits;
+
+    return edit_distance(str1, str2, script, &edits, 0, NULL);
+}
+
+unsigned int osa_distance(const char *str1, const char *str2, edit **script)
+{
+    unsigned int edits;
+
+    return edit_distance(str1, str2, script, &edits, 1, NULL);
+}
+
+unsigned int weighted_distance(const char *str1, const char *str2, const typosee_costs *costs, int osa,
+        edit **script, unsigned int *edits)
+{
+    return edit_distance(str1, str2, script, edits, osa, costs);
+}
+
+
+/* Punycode (RFC 3492) parameters */
+#define PUNY_BASE       36
+#define PUNY_TMIN       1
+#define PUNY_TMAX       26
+#define PUNY_SKEW       38
+#define PUNY_DAMP       700
+
+static int is_punycode(const char *s, size_t len)
+{
+    return len > 4 && (s[0] | 0x20) == 'x' && (s[1] | 0x20) == 'n' && s[2] == '-' && s[3] == '-';
+}
+
+static uint32_t puny_adapt(uint32_t delta, uint32_t points, int first)
+{
+    uint32_t k = 0;
+
+    delta = first ? delta / PUNY_DAMP : delta / 2;
+    delta += delta / points;
+    while (delta > ((PUNY_BASE - PUNY_TMIN) * PUNY_TMAX) / 2) {
+        delta /= PUNY_BASE - PUNY_TMIN;
+        k += PUNY_BASE;
+    }
+    return k + (PUNY_BASE - PUNY_TMIN + 1) * delta / (delta + PUNY_SKEW);
+}
+
+/*
+ * Decodes the punycode label s ("xn--" included) into at most len code points at
+ * out. Returns how many, or -1 if it isn't valid punycode.
+ */
+static int64_t puny_decode(const char *s, size_t len, uint32_t *out)
+{
+    uint32_t n = 128, i = 0, bias = 72, oldi, w, k, t, digit;
+    size_t basic, start, in, count = 0;
+
+    s += 4;
+    len -= 4;
+    for (start = len; start > 0 && s[start - 1] != '-'; start--)
+        ;
+    basic = start ? start - 1 : 0;      /* code points before the last '-' stand for themselves */
+    for (in = 0; in < basic; in++) {
+        if ((unsigned char)s[in] >= 0x80) {
+            return -1;
+        }
+        out[count++] = (unsigned char)s[in];
+    }
+    for (in = start; in < len; count++) {
+        oldi = i;
+        for (w = 1, k = PUNY_BASE; ; k += PUNY_BASE) {
+            if (in >= len) {
+                return -1;
+            }
+            digit = s[in] >= '0' && s[in] <= '9' ? (uint32_t)(s[in] - '0' + 26)
+                : (s[in] | 0x20) >= 'a' && (s[in] | 0x20) <= 'z' ? (uint32_t)((s[in] | 0x20) - 'a') : PUNY_BASE;
+            in++;
+            if (digit >= PUNY_BASE || digit > (UINT32_MAX - i) / w) {
+                return -1;
+            }
+            i += digit * w;
+            t = k <= bias ? PUNY_TMIN : k >= bias + PUNY_TMAX ? PUNY_TMAX : k - bias;
+            if (digit < t) {
+                break;
+            }
+            if (w > UINT32_MAX / (PUNY_BASE - t)) {
+                return -1;
+            }
+            w *= PUNY_BASE - t;
+        }
+        bias = puny_adapt(i - oldi, count + 1, oldi == 0);
+        if (i / (count + 1) > UINT32_MAX - n || count >= len) {
+            return -1;
+        }
+        n += i / (count + 1);
+        i %= count + 1;
+        memmove(out + i + 1, out + i, (count - i) * sizeof(uint32_t));
+        out[i++] = n;
+    }
+    return count;
+}
+
+/* UTF-8 to code points; a byte that doesn't start a valid sequence stands for itself */
+static size_t utf8_decode(const char *s, size_t len, uint32_t *out)
+{
+    const unsigned char *p = (const unsigned char *)s, *end = p + len;
+    size_t count = 0, need, j;
+    uint32_t c;
+
+    while (p < end) {
+        need = *p >= 0xf0 && *p < 0xf8 ? 3 : *p >= 0xe0 ? 2 : *p >= 0xc2 && *p < 0xe0 ? 1 : 0;
+        if (*p >= 0xf8) {
+            need = 0;
+        }
+        c = need == 3 ? *p & 0x07 : need == 2 ? *p & 0x0f : need == 1 ? *p & 0x1f : *p;
+        for (j = 1; j <= need; j++) {
+            if (p + j >= end || (p[j] & 0xc0) != 0x80) {
+                break;
+            }
+            c = (c << 6) | (p[j] & 0x3f);
+        }
+        if (j <= need) {
+            c = *p;
+            need = 0;
+        }
+        out[count++] = c;
+        p += need + 1;
+    }
+    return count;
+}
+
+/* Code points of a keyword or label: punycode decoded, anything else read as UTF-8 */
+static size_t to_code_points(const char *s, size_t len, uint32_t *out)
+{
+    int64_t n;
+
+    if (is_punycode(s, len) && (n = puny_decode(s, len, out)) >= 0) {
+        return n;
+    }
+    return utf8_decode(s, len, out);
+}
+
+/*
+ * Confusables: code points that look like a Latin letter or digit, after the UTS #39
+ * skeleton mapping, folded to what they look like. Sorted for binary search; ASCII
+ * and fullwidth forms are handled in skeleton_char().
+ */
+static const struct {
+    uint32_t from;
+    uint32_t to;
+} confusables[] = {
+    { 0x0131, 'i' }, { 0x01c0, 'l' }, { 0x0251, 'a' }, { 0x0261, 'g' }, { 0x0391, 'a' }, { 0x0392, 'b' },
+    { 0x0395, 'e' }, { 0x0396, 'z' }, { 0x0397, 'h' }, { 0x0399, 'l' }, { 0x039a, 'k' }, { 0x039c, 'm' },
+    { 0x039d, 'n' }, { 0x039f, 'o' }, { 0x03a1, 'p' }, { 0x03a4, 't' }, { 0x03a5, 'y' }, { 0x03a7, 'x' },
+    { 0x03b1, 'a' }, { 0x03b9, 'i' }, { 0x03ba, 'k' }, { 0x03bd, 'v' }, { 0x03bf, 'o' }, { 0x03c1, 'p' },
+    { 0x03c5, 'u' }, { 0x03c7, 'x' }, { 0x0405, 's' }, { 0x0406, 'l' }, { 0x0408, 'j' }, { 0x0410, 'a' },
+    { 0x0412, 'b' }, { 0x0415, 'e' }, { 0x041a, 'k' }, { 0x041c, 'm' }, { 0x041d, 'h' }, { 0x041e, 'o' },
+    { 0x0420, 'p' }, { 0x0421, 'c' }, { 0x0422, 't' }, { 0x0425, 'x' }, { 0x0430, 'a' }, { 0x0435, 'e' },
+    { 0x043e, 'o' }, { 0x0440, 'p' }, { 0x0441, 'c' }, { 0x0443, 'y' }, { 0x0445, 'x' }, { 0x0455, 's' },
+    { 0x0456, 'i' }, { 0x0458, 'j' }, { 0x04af, 'y' }, { 0x04bb, 'h' }, { 0x04cf, 'l' }, { 0x0501, 'd' },
+    { 0x051b, 'q' }, { 0x051d, 'w' }, { 0x0570, 'h' }, { 0x0578, 'n' }, { 0x057d, 'u' }, { 0x0581, 'g' },
+    { 0x0585, 'o' }, { 0x13a0, 'd' }, { 0x13a1, 'r' }, { 0x13a2, 't' }, { 0x13a5, 'i' }, { 0x13aa, 'g' },
+    { 0x2113, 'l' }, { 0x2170, 'i' }, { 0x217c, 'l' }, { 0x217d, 'c' }, { 0x217e, 'd' }, { 0x217f, 'm' },
+};
+
+static uint32_t skeleton_char(uint32_t c)
+{
+    size_t lo = 0, hi = sizeof(confusables) / sizeof(confusables[0]), mid;
+
+    if (c < 0x80) {
+        if (c >= 'A' && c <= 'Z') {
+            c += 'a' - 'A';
+        }
+        return c == '0' ? 'o' : c == '1' || c == '|' ? 'l' : c;
+    }
+    if (c >= 0xff01 && c <= 0xff5e) {
+        return skeleton_char(c - 0xfee0);       /* fullwidth ASCII */
+    }
+    while (lo < hi) {
+        mid = (lo + hi) / 2;
+        if (confusables[mid].from == c) {
+            return confusables[mid].to;
+        }
+        if (confusables[mid].from < c) {
+            lo = mid + 1;
+        }
+        else {
+            hi = mid;
+        }
+    }
+    return c;
+}
+
+/*
+ * Skeleton of n code points, in place (it is never longer), with the pairs that read
+ * as one letter folded: rn -> m, vv -> w, cl -> d. Returns its length.
+ */
+static size_t skeleton(uint32_t *cp, size_t n)
+{
+    size_t i, out = 0;
+    uint32_t c;
+
+    for (i = 0; i < n; i++) {
+        c = skeleton_char(cp[i]);
+        if (out && ((cp[out - 1] == 'r' && c == 'n') || (cp[out - 1] == 'v' && c == 'v')
+                || (cp[out - 1] == 'c' && c == 'l'))) {
+            cp[out - 1] = c == 'n' ? 'm' : c == 'v' ? 'w' : 'd';
+            continue;
+        }
+        cp[out++] = c;
+    }
+    return out;
+}
+
+/* FNV-1a over the code points */
+static uint64_t skeleton_hash(const uint32_t *cp, size_t n)
+{
+    uint64_t h = 0xcbf29ce484222325ull;
+    size_t i;
+
+    for (i = 0; i < n; i++) {
+        h = (h ^ cp[i]) * 0x100000001b3ull;
+    }
+    return h;
+}
+
+/* Skeletons of every keyword, and the hash table labels are looked up in */
+static int set_skeletons(typosee_set *set)
+{
+    size_t size = 16, total = 0, slot;
+    unsigned int k;
+
+    for (k = 0; k < set->count; k++) {
+        total += set->cp_len[k];
+    }
+    while (size < 2 * (size_t)set->count) {
+        size *= 2;
+    }
+    set->skel = malloc((total ? total : 1) * sizeof(uint32_t));
+    set->skel_off = malloc((set->count ? set->count : 1) * sizeof(size_t));
+    set->skel_len = malloc((set->count ? set->count : 1) * sizeof(size_t));
+    set->skel_hash = malloc((set->count ? set->count : 1) * sizeof(uint64_t));
+    set->skel_table = calloc(size, sizeof(uint32_t));
+    if (!set->skel || !set->skel_off || !set->skel_len || !set->skel_hash || !set->skel_table) {
+        return -1;
+    }
+    set->skel_mask = size - 1;
+    for (k = 0, total = 0; k < set->count; k++) {
+        memcpy(set->skel + total, set->cp + set->cp_off[k], set->cp_len[k] * sizeof(uint32_t));
+        set->skel_off[k] = total;
+        set->skel_len[k] = skeleton(set->skel + total, set->cp_len[k]);
+        set->skel_hash[k] = skeleton_hash(set->skel + total, set->skel_len[k]);
+        total += set->skel_len[k];
+        for (slot = set->skel_hash[k] & set->skel_mask; set->skel_table[slot]; slot = (slot + 1) & set->skel_mask)
+            ;
+        set->skel_table[slot] = k + 1;
+    }
+    return 0;
+}
+
+/* FNV-1a over the bytes; labels are hashed this way as they are added to a batch */
+static uint64_t label_hash(const char *s, size_t len)
+{
+    uint64_t h = 0xcbf29ce484222325ull;
+    size_t i;
+
+    for (i = 0; i < len; i++) {
+        h = (h ^ (unsigned char)s[i]) * 0x100000001b3ull;
+    }
+    return h & LABEL_HASH_MASK;
+}
+
+/* The high half of the hash picks the bucket; the whole of it, mixed with the bucket's displacement, the slot */
+static uint32_t exact_bucket(uint64_t h, uint32_t buckets)
+{
+    return (uint32_t)((h >> 32) * buckets >> 32);
+}
+
+static uint32_t exact_slot(uint64_t h, uint32_t seed, uint32_t slots)
+{
+    h ^= seed * 0x9e3779b97f4a7c15ull;
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdull;
+    h ^= h >> 33;
+    return (uint32_t)((h & 0xffffffff) * slots >> 32);
+}
+
+/*
+ * Minimal perfect hash of the distinct keywords, by hash and displace (CHD): they
+ * fall into buckets of about four on their hash, and each bucket, the largest first,
+ * takes the first displacement that sends all of its keywords to free slots. A
+ * repeated keyword is chained from the first with its text. Should two different
+ * keywords hash alike, the set goes without (exact_seed NULL), and exact hits take
+ * the kernels like any other.
+ */
+static int set_exact(typosee_set *set)
+{
+    size_t n = set->count ? set->count : 1, size = 16, probe;
+    uint64_t *hash = malloc(n * sizeof(uint64_t));
+    uint32_t *table, *tail, *uniq, *start = NULL, *members = NULL, m = 0, b, i, j, k, seed, biggest = 0, want;
+    unsigned char *taken = NULL;
+    int rc = -1;
+
+    while (size < 2 * n) {
+        size *= 2;
+    }
+    table = calloc(size, sizeof(uint32_t));
+    tail = malloc(n * sizeof(uint32_t));
+    uniq = malloc(n * sizeof(uint32_t));
+    if ((set->exact_next = malloc(n * sizeof(uint32_t))) == NULL || !hash || !table || !tail || !uniq) {
+        goto out;
+    }
+    for (k = 0; k < set->count; k++) {
+        hash[k] = label_hash(set->arena + set->off[k], set->len[k]);
+        set->exact_next[k] = UINT32_MAX;
+        for (probe = hash[k] & (size - 1); table[probe] && hash[table[probe] - 1] != hash[k]; probe = (probe + 1) & (size - 1))
+            ;
+        if (!table[probe]) {
+            table[probe] = k + 1;
+            tail[k] = k;
+            uniq[m++] = k;
+            continue;
+        }
+        j = table[probe] - 1;
+        if (set->len[j] != set->len[k] || memcmp(set->arena + set->off[j], set->arena + set->off[k], set->len[k])) {
+            rc = 0;                     /* two keywords, one hash: no displacement can part them */
+            goto out;
+        }
+        set->exact_next[tail[j]] = k;
+        tail[j] = k;
+    }
+
+    /* Bucket the distinct keywords: bucket b holds members[start[b] .. start[b + 1]) */
+    set->exact_buckets = m / 4 + 1;
+    start = calloc(set->exact_buckets + 1, sizeof(uint32_t));
+    members = malloc((m ? m : 1) * sizeof(uint32_t));
+    taken = calloc(m ? m : 1, 1);
+    set->exact_seed = calloc(set->exact_buckets, sizeof(uint32_t));
+    set->exact_key = malloc((m ? m : 1) * sizeof(uint32_t));
+    if (!start || !members || !taken || !set->exact_seed || !set->exact_key) {
+        goto out;
+    }
+    for (i = 0; i < m; i++) {
+        start[exact_bucket(hash[uniq[i]], set->exact_buckets) + 1]++;
+    }
+    for (b = 0; b < set->exact_buckets; b++) {
+        biggest = start[b + 1] > biggest ? start[b + 1] : biggest;
+        start[b + 1] += start[b];
+        tail[b] = start[b];             /* where the bucket's next member goes */
+    }
+    for (i = 0; i < m; i++) {
+        members[tail[exact_bucket(hash[uniq[i]], set->exact_buckets)]++] = uniq[i];
+    }
+
+    /* Largest buckets first, while the table is empty enough to take them whole */
+    for (want = biggest; want > 0; want--) {
+        for (b = 0; b < set->exact_buckets; b++) {
+            if (start[b + 1] - start[b] != want) {
+                continue;
+            }
+            for (seed = 0; ; seed++) {
+                for (i = start[b]; i < start[b + 1] && !taken[j = exact_slot(hash[members[i]], seed, m)]; i++) {
+                    taken[j] = 1;
+                }
+                if (i == start[b + 1]) {
+                    break;
+                }
+                while (i-- > start[b]) {
+                    taken[exact_slot(hash[members[i]], seed, m)] = 0;
+                }
+            }
+            set->exact_seed[b] = seed;
+            for (i = start[b]; i < start[b + 1]; i++) {
+                set->exact_key[exact_slot(hash[members[i]], seed, m)] = members[i];
+            }
+        }
+    }
+    set->exact_slots = m;
+    set->bytes += (set->exact_buckets + m + set->count) * sizeof(uint32_t);
+    rc = 0;
+out:
+    if (set->exact_slots == 0) {
+        free(set->exact_seed);
+        free(set->exact_key);
+        free(set->exact_next);
+        set->exact_seed = set->exact_key = set->exact_next = NULL;
+    }
+    free(hash);
+    free(table);
+    free(tail);
+    free(uniq);
+    free(start);
+    free(members);
+    free(taken);
+    return rc;
+}
+
+/* The first keyword whose text a label is, or UINT32_MAX: one probe and one compare */
+static uint32_t set_exact_find(const typosee_set *set, uint64_t h, const char *s, size_t len)
+{
+    uint32_t k;
+
+    if (set->exact_slots == 0) {
+        return UINT32_MAX;
+    }
+    k = set->exact_key[exact_slot(h, set->exact_seed[exact_bucket(h, set->exact_buckets)], set->exact_slots)];
+    return set->len[k] == len && !memcmp(set->arena + set->off[k], s, len) ? k : UINT32_MAX;
+}
+
+typosee_set *typosee_set_compile(const char *const *keywords, const size_t *lens, unsigned int n)
+{
+    typosee_set *set = calloc(1, sizeof(*set));
+    size_t total = 0, len;
+    unsigned int k;
+
+    if (set == NULL) {
+        return NULL;
+    }
+    for (k = 0; k < n; k++) {
+        total += (lens ? lens[k] : strlen(keywords[k])) + 1;
+    }
+    set->arena = malloc(total ? total : 1);
+    set->off = malloc((n ? n : 1) * sizeof(size_t));
+    set->len = malloc((n ? n : 1) * sizeof(size_t));
+    set->cp = malloc((total ? total : 1) * sizeof(uint32_t));
+    set->cp_off = malloc((n ? n : 1) * sizeof(size_t));
+    set->cp_len = malloc((n ? n : 1) * sizeof(size_t));
+    if (set->arena == NULL || set->off == NULL || set->len == NULL
+            || set->cp == NULL || set->cp_off == NULL || set->cp_len == NULL) {
+        typosee_set_free(set);
+        return NULL;
+    }
+    for (k = 0, total = 0; k < n; k++) {
+        len = lens ? lens[k] : strlen(keywords[k]);
+        memcpy(set->arena + total, keywords[k], len);
+        set->arena[total + len] = 0x0;
+        set->off[k] = total;
+        set->len[k] = len;
+        set->cp_off[k] = k ? set->cp_off[k - 1] + set->cp_len[k - 1] : 0;
+        set->cp_len[k] = to_code_points(keywords[k], len, set->cp + set->cp_off[k]);
+        total += len + 1;
+    }
+    set->count = n;
+    set->bytes = total + n * 2 * sizeof(size_t);
+    if (set_skeletons(set) < 0 || set_exact(set) < 0) {
+        typosee_set_free(set);
+        return NULL;
+    }
+    return set;
+}
+
+void typosee_set_free(typosee_set *set)
+{
+    if (set) {
+        free(set->arena);
+        free(set->off);
+        free(set->len);
+        free(set->cp);
+        free(set->cp_off);
+        free(set->cp_len);
+        free(set->skel);
+        free(set->skel_off);
+        free(set->skel_len);
+        free(set->skel_hash);
+        free(set->skel_table);
+        free(set->exact_seed);
+        free(set->exact_key);
+        free(set->exact_next);
+        free(set->limit);
+        free(set->anchor);
+        free(set->anchor_dist);
+        free(set);
+    }
+}
+
+int typosee_set_threshold(typosee_set *set, unsigned int k, unsigned int threshold)
+{
+    unsigned int i;
+
+    if (set->limit == NULL) {
+        if ((set->limit = malloc((set->count ? set->count : 1) * sizeof(uint32_t))) == NULL) {
+            return -1;
+        }
+        for (i = 0; i < set->count; i++) {
+            set->limit[i] = UINT32_MAX;
+        }
+    }
+    set->limit[k] = threshold;
+    return 0;
+}
+
+/* Keyword k is held to its own threshold where it is the lower one */
+static unsigned int set_bound(const typosee_set *set, unsigned int k, unsigned int threshold)
+{
+    return set->limit && set->limit[k] < threshold ? set->limit[k] : threshold;
+}
+
+/* The lowest of the call's threshold, the keyword's own and the bound the caller gave it for this call */
+static unsigned int workspace_keyword_bound(const typosee_workspace *ws, const typosee_set *set, unsigned int k,
+        unsigned int threshold)
+{
+    threshold = set_bound(set, k, threshold);
+    return ws->bounds && ws->bounds[k] < threshold ? ws->bounds[k] : threshold;
+}
+
+/*
+ * Greedy clustering: a keyword within radius of one of the latest CLUSTER_WINDOW
+ * leaders is anchored on the closest of them, and becomes a leader itself otherwise.
+ * Leaders are looked at only when their length is within radius, and each distance is
+ * the banded one, given up once it is past radius.
+ */
+int typosee_set_clusters(typosee_set *set, unsigned int radius)
+{
+    typosee_workspace *ws = typosee_workspace_new();
+    uint32_t leaders[CLUSTER_WINDOW], k, l, nleaders = 0;
+    unsigned int d, best, anchored = 0;
+    size_t gap;
+
+    free(set->anchor);
+    free(set->anchor_dist);
+    set->anchor = malloc((set->count ? set->count : 1) * sizeof(uint32_t));
+    set->anchor_dist = malloc(set->count ? set->count : 1);
+    if (ws == NULL || set->anchor == NULL || set->anchor_dist == NULL) {
+        typosee_workspace_free(ws);
+        free(set->anchor);
+        free(set->anchor_dist);
+        set->anchor = NULL;
+        set->anchor_dist = NULL;
+        return -1;
+    }
+    radius = radius < TRI_UNKNOWN ? radius : TRI_UNKNOWN - 1;
+    for (k = 0; k < set->count; k++) {
+        set->anchor[k] = UINT32_MAX;
+        best = radius + 1;
+        for (l = 0; l < nleaders && l < CLUSTER_WINDOW; l++) {
+            gap = set->len[k] > set->len[leaders[l]] ? set->len[k] - set->len[leaders[l]] : set->len[leaders[l]] - set->len[k];
+            if (gap >= best) {
+                continue;
+            }
+            if (workspace_bounded(ws, set->arena + set->off[leaders[l]], set->len[leaders[l]],
+                    set->arena + set->off[k], set->len[k], 0, best - 1, &d) < 0) {
+                typosee_workspace_free(ws);
+                return -1;
+            }
+            if (d < best) {
+                best = d;
+                set->anchor[k] = leaders[l];
+            }
+        }
+        if (set->anchor[k] == UINT32_MAX) {
+            leaders[nleaders++ % CLUSTER_WINDOW] = k;
+        }
+        else {
+            set->anchor_dist[k] = best;
+            anchored++;
+        }
+    }
+    typosee_workspace_free(ws);
+    return anchored;
+}
+
+unsigned int typosee_set_count(const typosee_set *set)
+{
+    return set->count;
+}
+
+const char *typosee_set_keyword(const typosee_set *set, unsigned int k)
+{
+    return set->arena + set->off[k];
+}
+
+size_t typosee_set_keyword_len(const typosee_set *set, unsigned int k)
+{
+    return set->len[k];
+}
+
+size_t typosee_set_footprint(const typosee_set *set)
+{
+    return set->bytes;
+}
+
+typosee_workspace *typosee_workspace_new(void)
+{
+    typosee_workspace *ws = calloc(1, sizeof(typosee_workspace));
+
+    if (ws) {
+        ws->kernel = kernel_select();
+        ws->stats.lanes = ws->kernel->lanes;
+        ws->scripts = 1;
+    }
+    return ws;
+}
+
+void typosee_workspace_free(typosee_workspace *ws)
+{
+    if (ws) {
+        free(ws->cells);
+        free(ws->rows);
+        free(ws->script);
+        free(ws->band);
+        free(ws->lanes);
+        free(ws->skel);
+        free(ws->glyphs);
+        free(ws->exacts);
+        free(ws->heap);
+        free(ws->label_heap);
+        free(ws->label_nheap);
+        free(ws->picks);
+        free(ws->tri);
+        free(ws->tri_slot);
+        free(ws->hits);
+        free(ws->hit_dist);
+        free(ws);
+    }
+}
+
+void typosee_workspace_stats(const typosee_workspace *ws, typosee_stats *st)
+{
+    st->isa = ws->kernel->name;
+    st->lanes = ws->stats.lanes;
+    st->kernel_pairs += ws->stats.kernel_pairs;
+    st->kernel_steps += ws->stats.kernel_steps;
+    st->lane_steps += ws->stats.lane_steps;
+    st->matrix_pairs += ws->stats.matrix_pairs;
+    st->idn_pairs += ws->stats.idn_pairs;
+    st->pairs += ws->stats.pairs;
+    st->length_rejects += ws->stats.length_rejects;
+    st->repeats += ws->stats.repeats;
+    st->triangle_skips += ws->stats.triangle_skips;
+    st->exact_lookups += ws->stats.exact_lookups;
+    st->cells += ws->stats.cells;
+    st->matches += ws->stats.matches;
+    st->homoglyphs += ws->stats.homoglyphs;
+    st->filter.wall_ns += ws->stats.filter.wall_ns;
+    st->filter.cpu_ns += ws->stats.filter.cpu_ns;
+    st->distance.wall_ns += ws->stats.distance.wall_ns;
+    st->distance.cpu_ns += ws->stats.distance.cpu_ns;
+    st->callback.wall_ns += ws->stats.callback.wall_ns;
+    st->callback.cpu_ns += ws->stats.callback.cpu_ns;
+}
+
+void typosee_workspace_timing(typosee_workspace *ws, int on)
+{
+    ws->timing = on;
+}
+
+void typosee_workspace_scripts(typosee_workspace *ws, int on)
+{
+    ws->scripts = on;
+}
+
+void typosee_workspace_substring(typosee_workspace *ws, int on)
+{
+    ws->substring = on;
+}
+
+void typosee_workspace_transpositions(typosee_workspace *ws, int on)
+{
+    ws->osa = on;
+}
+
+void typosee_workspace_costs(typosee_workspace *ws, const typosee_costs *costs)
+{
+    ws->costs = costs;
+}
+
+void typosee_workspace_top(typosee_workspace *ws, int mode, unsigned int k)
+{
+    ws->top = k ? mode : 0;
+    ws->top_k = k;
+}
+
+void typosee_workspace_bounds(typosee_workspace *ws, const unsigned int *bounds)
+{
+    ws->bounds = bounds;
+}
+
+void typosee_workspace_homoglyphs(typosee_workspace *ws, int on)
+{
+    ws->homoglyphs = on;
+}
+
+static uint64_t clock_ns(clockid_t id)
+{
+    struct timespec ts;
+
+    clock_gettime(id, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+/* Charges the time since the last boundary to stage t, if timing */
+static void workspace_lap(typosee_workspace *ws, typosee_time *t)
+{
+    uint64_t wall, cpu;
+
+    if (!ws->timing) {
+        return;
+    }
+    wall = clock_ns(CLOCK_MONOTONIC);
+    cpu = clock_ns(CLOCK_THREAD_CPUTIME_ID);
+    if (t) {
+        t->wall_ns += wall - ws->mark.wall_ns;
+        t->cpu_ns += cpu - ws->mark.cpu_ns;
+    }
+    ws->mark.wall_ns = wall;
+    ws->mark.cpu_ns = cpu;
+}
+
+/* Lays a (len1 + 1) x (len2 + 1) matrix over the workspace, growing it if needed */
+static edit **workspace_matrix(typosee_workspace *ws, size_t len1, size_t len2)
+{
+    size_t i, cells = (len1 + 1) * (len2 + 1);
+    edit *p;
+    edit **rows;
+
+    if (cells > ws->cells_cap) {
+        if ((p = realloc(ws->cells, cells * sizeof(edit))) == NULL) {
+            return NULL;
+        }
+        ws->cells = p;
+        ws->cells_cap = cells;
+    }
+    if (len1 + 1 > ws->rows_cap) {
+        if ((rows = realloc(ws->rows, (len1 + 1) * sizeof(edit *))) == NULL) {
+            return NULL;
+        }
+        ws->rows = rows;
+        ws->rows_cap = len1 + 1;
+    }
+    for (i = 0; i <= len1; i++) {
+        ws->rows[i] = ws->cells + i * (len2 + 1);
+    }
+    return ws->rows;
+}
+
+/* Reads the edit script of the pair just calculated into the workspace; *edits is how long it is */
+static int workspace_script(typosee_workspace *ws, edit **mat, size_t len1, size_t len2,
+        unsigned int *edits)
+{
+    unsigned int distance = ws->costs ? levenshtein_edits(&mat[len1][len2]) : mat[len1][len2].score;
+    edit *p;
+
+    if (distance > ws->script_cap) {
+        if ((p = realloc(ws->script, distance * sizeof(edit))) == NULL) {
+            return -1;
+        }
+        ws->script = p;
+        ws->script_cap = distance;
+    }
+    if (distance) {
+        levenshtein_traceback(&mat[len1][len2], ws->script, distance);
+    }
+    *edits = distance;
+    return 0;
+}
+
+void typosee_batch_init(typosee_batch *b)
+{
+    memset(b, 0, sizeof(*b));
+}
+
+/* Decodes the punycode label just added; one that doesn't decode stays an ordinary label */
+static int batch_add_idn(typosee_batch *b, const char *label, size_t len)
+{
+    size_t cap;
+    int64_t count;
+    void *p;
+
+    if (b->cp_len + len > b->cp_cap) {
+        cap = b->cp_cap * 2 > b->cp_len + len ? b->cp_cap * 2 : b->cp_len + len;
+        if ((p = realloc(b->cp, cap * sizeof(uint32_t))) == NULL) {
+            return -1;
+        }
+        b->cp = p;
+        b->cp_cap = cap;
+    }
+    if ((count = puny_decode(label, len, b->cp + b->cp_len)) < 0) {
+        return 0;
+    }
+    if (b->nidn == b->idn_cap) {
+        cap = b->idn_cap ? b->idn_cap * 2 : 64;
+        if ((p = realloc(b->idn, cap * sizeof(uint32_t))) == NULL) {
+            return -1;
+        }
+        b->idn = p;
+        if ((p = realloc(b->idn_off, cap * sizeof(uint32_t))) == NULL) {
+            return -1;
+        }
+        b->idn_off = p;
+        if ((p = realloc(b->idn_len, cap * sizeof(uint32_t))) == NULL) {
+            return -1;
+        }
+        b->idn_len = p;
+        b->idn_cap = cap;
+    }
+    b->idn[b->nidn] = b->n - 1;
+    b->idn_off[b->nidn] = b->cp_len;
+    b->idn_len[b->nidn] = count;
+    b->nidn++;
+    b->cp_len += count;
+    return 0;
+}
+
+int typosee_batch_add(typosee_batch *b, const char *label, size_t len, uint32_t line)
+{
+    size_t cap;
+    void *p;
+
+    if (b->arena_len + len + 1 > b->arena_cap) {
+        cap = b->arena_cap * 2 > b->arena_len + len + 1 ? b->arena_cap * 2 : b->arena_len + len + 1;
+        if ((p = realloc(b->arena, cap)) == NULL) {
+            return -1;
+        }
+        b->arena = p;
+        b->arena_cap = cap;
+    }
+    if (b->n == b->cap) {
+        cap = b->cap ? b->cap * 2 : 1024;
+        if ((p = realloc(b->off, cap * sizeof(uint32_t))) == NULL) {
+            return -1;
+        }
+        b->off = p;
+        if ((p = realloc(b->len, cap * sizeof(uint32_t))) == NULL) {
+            return -1;
+        }
+        b->len = p;
+        if ((p = realloc(b->line, cap * sizeof(uint32_t))) == NULL) {
+            return -1;
+        }
+        b->line = p;
+        if ((p = realloc(b->hash, cap * sizeof(uint64_t))) == NULL) {
+            return -1;
+        }
+        b->hash = p;
+        b->cap = cap;
+    }
+    memcpy(b->arena + b->arena_len, label, len);
+    b->arena[b->arena_len + len] = 0x0;
+    b->off[b->n] = b->arena_len;
+    b->len[b->n] = len;
+    b->line[b->n] = line;
+    b->hash[b->n] = label_hash(label, len);
+    b->n++;
+    b->arena_len += len + 1;
+    b->sealed = 0;
+    return is_punycode(label, len) ? batch_add_idn(b, label, len) : 0;
+}
+
+/*
+ * Chains each label to the first earlier one with its text, by the hashes taken as
+ * they were added, and leaves a distinct one in unique[] with how many labels it
+ * stands for in copies[]. Punycode labels are left out. Returns how many are distinct.
+ */
+static int64_t batch_fold(typosee_batch *b, uint32_t *unique, uint32_t *copies)
+{
+    uint32_t *table, *tail, j, u, nunique = 0;
+    size_t size = 16, probe, i, d;
+
+    while (size < 2 * b->n) {
+        size *= 2;
+    }
+    table = calloc(size, sizeof(uint32_t));
+    tail = malloc((b->n ? b->n : 1) * sizeof(uint32_t));
+    if (table == NULL || tail == NULL) {
+        free(table);
+        free(tail);
+        return -1;
+    }
+    for (i = 0, d = 0; i < b->n; i++) {
+        b->same[i] = UINT32_MAX;
+        if (d < b->nidn && b->idn[d] == i) {
+            d++;
+            continue;
+        }
+        for (probe = b->hash[i] & (size - 1); (u = table[probe]) != 0; probe = (probe + 1) & (size - 1)) {
+            j = unique[u - 1];
+            if (b->hash[j] == b->hash[i] && b->len[j] == b->len[i]
+                    && !memcmp(b->arena + b->off[j], b->arena + b->off[i], b->len[i])) {
+                break;
+            }
+        }
+        if (u) {
+            b->same[tail[u - 1]] = i;
+            tail[u - 1] = i;
+            copies[u - 1]++;
+            continue;
+        }
+        table[probe] = nunique + 1;
+        tail[nunique] = i;
+        copies[nunique] = 1;
+        unique[nunique++] = i;
+    }
+    free(table);
+    free(tail);
+    return nunique;
+}
+
+/* Counting sort of the distinct labels on length; stable, so labels of one length stay in batch order */
+int typosee_batch_seal(typosee_batch *b)
+{
+    uint32_t max = 0, total = 0, c, *count, *unique, *copies;
+    int64_t nunique;
+    size_t i;
+
+    free(b->order);
+    free(b->same);
+    free(b->upto);
+    b->order = malloc((b->n ? b->n : 1) * sizeof(uint32_t));
+    b->same = malloc((b->n ? b->n : 1) * sizeof(uint32_t));
+    b->upto = malloc((b->n + 1) * sizeof(uint32_t));
+    unique = malloc((b->n ? b->n : 1) * sizeof(uint32_t));
+    copies = malloc((b->n ? b->n : 1) * sizeof(uint32_t));
+    if (!b->order || !b->same || !b->upto || !unique || !copies || (nunique = batch_fold(b, unique, copies)) < 0) {
+        free(unique);
+        free(copies);
+        return -1;
+    }
+    b->nunique = nunique;
+    for (i = 0; i < b->nunique; i++) {
+        max = b->len[unique[i]] > max ? b->len[unique[i]] : max;
+    }
+    if ((count = calloc(max + 2, sizeof(uint32_t))) == NULL) {
+        free(unique);
+        free(copies);
+        return -1;
+    }
+    for (i = 0; i < b->nunique; i++) {
+        count[b->len[unique[i]] + 1]++;
+    }
+    for (i = 1; i <= max + 1; i++) {
+        count[i] += count[i - 1];
+    }
+    for (i = 0; i < b->nunique; i++) {
+        b->upto[count[b->len[unique[i]]]] = copies[i];
+        b->order[count[b->len[unique[i]]]++] = unique[i];
+    }
+    for (i = 0; i < b->nunique; i++) {
+        c = b->upto[i];
+        b->upto[i] = total;
+        total += c;
+    }
+    b->upto[b->nunique] = total;
+    free(count);
+    free(unique);
+    free(copies);
+    b->sealed = 1;
+    return 0;
+}
+
+void typosee_batch_clear(typosee_batch *b)
+{
+    b->arena_len = 0;
+    b->n = 0;
+    b->nidn = 0;
+    b->cp_len = 0;
+    b->sealed = 0;
+}
+
+void typosee_batch_free(typosee_batch *b)
+{
+    free(b->arena);
+    free(b->off);
+    free(b->len);
+    free(b->line);
+    free(b->order);
+    free(b->hash);
+    free(b->same);
+    free(b->upto);
+    free(b->idn);
+    free(b->idn_off);
+    free(b->idn_len);
+    free(b->cp);
+    typosee_batch_init(b);
+}
+
+/* First position in order[] whose label is at least len bytes long */
+static size_t batch_lower_bound(const typosee_batch *b, size_t len)
+{
+    size_t lo = 0, hi = b->nunique, mid;
+
+    while (lo < hi) {
+        mid = lo + (hi - lo) / 2;
+        if (b->len[b->order[mid]] < len) {
+            lo = mid + 1;
+        }
+        else {
+            hi = mid;
+        }
+    }
+    return lo;
+}
+
+static void peq_build(uint64_t *peq, const char *str, size_t len)
+{
+    size_t i;
+
+    memset(peq, 0, 256 * sizeof(uint64_t));
+    for (i = 0; i < len; i++) {
+        peq[(unsigned char)str[i]] |= 1ull << i;
+    }
+}
+
+/* One build of the myers_*lanes() and weighted_*column() kernels per instruction set; the vector width grows with the registers */
+#define KERNEL_SUFFIX   scalar
+#define KERNEL_LANES    1
+#define KERNEL_TARGET
+#include "libtyposee_kernel.h"
+
+#define KERNEL_SUFFIX   sse41
+#define KERNEL_LANES    2
+#define KERNEL_TARGET   __attribute__((target("sse4.1")))
+#include "libtyposee_kernel.h"
+
+#define KERNEL_SUFFIX   avx2
+#define KERNEL_LANES    4
+#define KERNEL_TARGET   __attribute__((target("avx2")))
+#include "libtyposee_kernel.h"
+
+#define KERNEL_SUFFIX   avx512
+#define KERNEL_LANES    8
+#define KERNEL_TARGET   __attribute__((target("avx512f")))
+#include "libtyposee_kernel.h"
+
+/* Best first */
+static const struct kernel kernels[] = {
+    { "avx512", 8, { myers_lanes_avx512, myers_search_lanes_avx512, myers_osa_lanes_avx512,
+        myers_osa_search_lanes_avx512 },
+        weighted_keyword_avx512, { weighted_column_avx512, weighted_osa_column_avx512 } },
+    { "avx2", 4, { myers_lanes_avx2, myers_search_lanes_avx2, myers_osa_lanes_avx2,
+        myers_osa_search_lanes_avx2 },
+        weighted_keyword_avx2, { weighted_column_avx2, weighted_osa_column_avx2 } },
+    { "sse4.1", 2, { myers_lanes_sse41, myers_search_lanes_sse41, myers_osa_lanes_sse41,
+        myers_osa_search_lanes_sse41 },
+        weighted_keyword_sse41, { weighted_column_sse41, weighted_osa_column_sse41 } },
+    { "scalar", 1, { myers_lanes_scalar, myers_search_lanes_scalar, myers_osa_lanes_scalar,
+        myers_osa_search_lanes_scalar },
+        NULL, { NULL, NULL } },
+};
+
+#define NKERNELS        (sizeof(kernels) / sizeof(kernels[0]))
+
+static const struct kernel *kernel_forced;
+
+static int kernel_supported(const struct kernel *k)
+{
+    __builtin_cpu_init();
+    if (k->myers[0] == myers_lanes_avx512) {
+        return __builtin_cpu_supports("avx512f");
+    }
+    if (k->myers[0] == myers_lanes_avx2) {
+        return __builtin_cpu_supports("avx2");
+    }
+    if (k->myers[0] == myers_lanes_sse41) {
+        return __builtin_cpu_supports("sse4.1");
+    }
+    return 1;
+}
+
+static const struct kernel *kernel_find(const char *name)
+{
+    unsigned int i;
+
+    for (i = 0; i < NKERNELS; i++) {
+        if (!strcmp(kernels[i].name, name)) {
+            return kernel_supported(&kernels[i]) ? &kernels[i] : NULL;
+        }
+    }
+    return NULL;
+}
+
+/* typosee_set_isa(), else $TYPOSEE_ISA if this CPU can run it, else the widest the CPU has */
+static const struct kernel *kernel_select(void)
+{
+    const char *env = getenv("TYPOSEE_ISA");
+    const struct kernel *k;
+    unsigned int i;
+
+    if (kernel_forced) {
+        return kernel_forced;
+    }
+    if (env && (k = kernel_find(env)) != NULL) {
+        return k;
+    }
+    for (i = 0; !kernel_supported(&kernels[i]); i++)
+        ;
+    return &kernels[i];
+}
+
+int typosee_set_isa(const char *name)
+{
+    const struct kernel *k = kernel_find(name);
+
+    if (k == NULL) {
+        return -1;
+    }
+    kernel_forced = k;
+    return 0;
+}
+
+const char *typosee_isa(void)
+{
+    return kernel_select()->name;
+}
+
+static int workspace_hit(typosee_workspace *ws, size_t n, uint32_t label, uint32_t distance)
+{
+    uint32_t *p;
+
+    if (n == ws->hits_cap) {
+        ws->hits_cap = ws->hits_cap ? ws->hits_cap * 2 : 256;
+        if ((p = realloc(ws->hits, ws->hits_cap * sizeof(uint32_t))) == NULL) {
+            return -1;
+        }
+        ws->hits = p;
+        if ((p = realloc(ws->hit_dist, ws->hits_cap * sizeof(uint32_t))) == NULL) {
+            return -1;
+        }
+        ws->hit_dist = p;
+    }
+    ws->hits[n] = label;
+    ws->hit_dist[n] = distance;
+    return 0;
+}
+
+/* Insertion sort back into label order; hits arrive sorted by length, and are few */
+static void workspace_sort_hits(typosee_workspace *ws, size_t n)
+{
+    size_t i, j;
+    uint32_t h, d;
+
+    for (i = 1; i < n; i++) {
+        h = ws->hits[i];
+        d = ws->hit_dist[i];
+        for (j = i; j > 0 && ws->hits[j - 1] > h; j--) {
+            ws->hits[j] = ws->hits[j - 1];
+            ws->hit_dist[j] = ws->hit_dist[j - 1];
+        }
+        ws->hits[j] = h;
+        ws->hit_dist[j] = d;
+    }
+}
+
+/* Distance of keyword str1 to str2 (a label or the part of one it was found in) by the Wagner-Fischer recurrence */
+static int workspace_distance(typosee_workspace *ws, const char *str1, size_t len1,
+        const char *str2, size_t len2, unsigned int *distance)
+{
+    edit **mat;
+
+    if (len1 == 0 || len2 == 0) {
+        *distance = len1 + len2;
+        return 0;
+    }
+    if ((mat = workspace_matrix(ws, len1, len2)) == NULL) {
+        return -1;
+    }
+    ws->stats.cells += len1 * len2;
+    levenshtein_matrix_borders(mat, str1, len1, str2, len2, ws->costs);
+    *distance = levenshtein_matrix_calculate(mat, str1, len1, str2, len2, ws->osa, ws->costs);
+    return 0;
+}
+
+/*
+ * Distance of str1 to str2 if it is at most k, otherwise some value over k. Only the
+ * 2k + 1 diagonals around the main one can hold a distance <= k (Ukkonen), so each
+ * row is computed over that band alone, on plain integers, and the pair is given up
+ * as soon as a whole row is over k. The strings are bytes, or code points if wide.
+ * With transpositions on, a third row is kept for the cells a swap reaches; a row's
+ * minimum never drops below the last one's, or the one before's plus a swap, so the
+ * early exit waits for both. With edit costs k is a cost, and the band is as wide as
+ * k buys the cheapest insertions or deletions.
+ */
+#define BAND_AT(s, wide, i)     ((wide) ? ((const uint32_t *)(s))[i] : ((const unsigned char *)(s))[i])
+
+static int workspace_bounded(typosee_workspace *ws, const void *str1, size_t len1,
+        const void *str2, size_t len2, int wide, unsigned int k, unsigned int *distance)
+{
+    const typosee_costs *costs = ws->costs;
+    size_t i, c, lo, hi, w;
+    uint32_t *prev2, *prev, *cur, *tmp, v, best, last, over, ch, edge, t;
+
+    if (len1 == 0 || len2 == 0) {
+        for (*distance = 0, i = 0; i < len1; i++) {
+            *distance += cost_del(costs, BAND_AT(str1, wide, i));
+        }
+        for (c = 0; c < len2; c++) {
+            *distance += cost_ins(costs, BAND_AT(str2, wide, c));
+        }
+        return 0;
+    }
+    /* Every diagonal off the main one costs an insertion or deletion */
+    w = !costs ? k : costs->min_indel ? k / costs->min_indel : len1 + len2;
+    if (w > len1 + len2) {
+        w = len1 + len2;
+    }
+    if (3 * (len2 + 1) > ws->band_cap) {
+        if ((tmp = realloc(ws->band, 3 * (len2 + 1) * sizeof(uint32_t))) == NULL) {
+            return -1;
+        }
+        ws->band = tmp;
+        ws->band_cap = 3 * (len2 + 1);
+    }
+    over = k + 1;
+    prev = ws->band;
+    cur = ws->band + len2 + 1;
+    prev2 = ws->band + 2 * (len2 + 1);
+    prev[0] = 0;
+    for (c = 1; c <= len2; c++) {
+        v = prev[c - 1] + cost_ins(costs, BAND_AT(str2, wide, c - 1));
+        prev[c] = v < over ? v : over;
+    }
+    for (i = 1, edge = 0, last = 0; i <= len1; i++) {
+        lo = i > w ? i - w : 1;
+        hi = i + w < len2 ? i + w : len2;
+        if (lo > hi) {
+            *distance = over;
+            return 0;
+        }
+        ch = BAND_AT(str1, wide, i - 1);
+        edge += cost_del(costs, ch);
+        edge = edge < over ? edge : over;
+        cur[lo - 1] = lo == 1 ? edge : over;
+        best = cur[lo - 1];
+        for (c = lo; c <= hi; c++) {
+            t = BAND_AT(str2, wide, c - 1);
+            v = prev[c - 1] + cost_sub(costs, ch, t);
+            v = prev[c] + cost_del(costs, ch) < v ? prev[c] + cost_del(costs, ch) : v;
+            v = cur[c - 1] + cost_ins(costs, t) < v ? cur[c - 1] + cost_ins(costs, t) : v;
+            if (ws->osa && i > 1 && c > 1 && ch == BAND_AT(str2, wide, c - 2)
+                    && BAND_AT(str1, wide, i - 2) == t) {
+                v = prev2[c - 2] + (costs ? costs->swap : 1) < v ? prev2[c - 2] + (costs ? costs->swap : 1) : v;
+            }
+            cur[c] = v < over ? v : over;
+            best = cur[c] < best ? cur[c] : best;
+        }
+        if (hi < len2) {
+            cur[hi + 1] = over;
+        }
+        ws->stats.cells += hi - lo + 1;
+        if (best > k && (!ws->osa || last + (costs ? costs->swap : 1) > k)) {
+            *distance = over;
+            return 0;
+        }
+        last = best;
+        tmp = prev2;
+        prev2 = prev;
+        prev = cur;
+        cur = tmp;
+    }
+    *distance = prev[len2];
+    return 0;
+}
+
+/*
+ * Sellers' approximate search of str1 in str2, one column of the recurrence per
+ * character of str2 with a free start in row 0: the distance of str1 to the closest
+ * substring of str2, and in *end the length of the shortest prefix of str2 that
+ * substring ends. With reverse set both strings are read back to front, which run
+ * over the prefix up to *end finds where the substring starts. Bytes, or code points
+ * if wide; for keywords the kernel can't take, punycode labels and locating matches.
+ */
+static int workspace_search(typosee_workspace *ws, const void *str1, size_t len1,
+        const void *str2, size_t len2, int wide, int reverse, unsigned int *distance, size_t *end)
+{
+    const typosee_costs *costs = ws->costs;
+    size_t i, c;
+    uint32_t *prev2, *prev, *cur, *tmp, v, ch, t;
+
+    if (3 * (len1 + 1) > ws->band_cap) {
+        if ((tmp = realloc(ws->band, 3 * (len1 + 1) * sizeof(uint32_t))) == NULL) {
+            return -1;
+        }
+        ws->band = tmp;
+        ws->band_cap = 3 * (len1 + 1);
+    }
+    prev = ws->band;
+    cur = ws->band + len1 + 1;
+    prev2 = ws->band + 2 * (len1 + 1);
+#define SEARCH_KW(i)    BAND_AT(str1, wide, reverse ? len1 - (i) : (i) - 1)
+#define SEARCH_TEXT(c)  BAND_AT(str2, wide, reverse ? len2 - (c) : (c) - 1)
+    prev[0] = 0;
+    for (i = 1; i <= len1; i++) {
+        prev[i] = prev[i - 1] + cost_del(costs, SEARCH_KW(i));
+    }
+    *distance = prev[len1];
+    *end = 0;
+    for (c = 1; c <= len2; c++) {
+        cur[0] = 0;
+        t = SEARCH_TEXT(c);
+        for (i = 1; i <= len1; i++) {
+            ch = SEARCH_KW(i);
+            v = prev[i - 1] + cost_sub(costs, ch, t);
+            v = prev[i] + cost_ins(costs, t) < v ? prev[i] + cost_ins(costs, t) : v;
+            v = cur[i - 1] + cost_del(costs, ch) < v ? cur[i - 1] + cost_del(costs, ch) : v;
+            if (ws->osa && i > 1 && c > 1 && ch == SEARCH_TEXT(c - 1) && SEARCH_KW(i - 1) == t) {
+                v = prev2[i - 2] + (costs ? costs->swap : 1) < v ? prev2[i - 2] + (costs ? costs->swap : 1) : v;
+            }
+            cur[i] = v;
+        }
+        if (cur[len1] < *distance) {
+            *distance = cur[len1];
+            *end = c;
+        }
+        tmp = prev2;
+        prev2 = prev;
+        prev = cur;
+        cur = tmp;
+    }
+#undef SEARCH_KW
+#undef SEARCH_TEXT
+    ws->stats.cells += len1 * len2;
+    return 0;
+}
+
+/* Where in label j keyword k was found: byte offset and length, or code points for a punycode label */
+static int workspace_locate(typosee_workspace *ws, const typosee_set *set, unsigned int k,
+        const typosee_batch *b, uint32_t j, size_t idn, typosee_match *m)
+{
+    const void *str1 = set->arena + set->off[k], *str2 = b->arena + b->off[j];
+    size_t len1 = set->len[k], len2 = b->len[j], end, span;
+    unsigned int distance;
+    int wide = idn < b->nidn;
+
+    if (wide) {
+        str1 = set->cp + set->cp_off[k];
+        len1 = set->cp_len[k];
+        str2 = b->cp + b->idn_off[idn];
+        len2 = b->idn_len[idn];
+    }
+    if (workspace_search(ws, str1, len1, str2, len2, wide, 0, &distance, &end) < 0
+            || workspace_search(ws, str1, len1, str2, end, wide, 1, &distance, &span) < 0) {
+        return -1;
+    }
+    m->offset = end - span;
+    m->length = span;
+    return 0;
+}
+
+/* Distance a skeleton collision is filed under among the hits */
+#define GLYPH_HIT               UINT32_MAX
+
+/* Where label j is in the batch's list of punycode labels, or nidn if it isn't one */
+static size_t batch_idn(const typosee_batch *b, uint32_t j)
+{
+    size_t lo = 0, hi = b->nidn, mid;
+
+    while (lo < hi) {
+        mid = lo + (hi - lo) / 2;
+        if (b->idn[mid] < j) {
+            lo = mid + 1;
+        }
+        else {
+            hi = mid;
+        }
+    }
+    return lo < b->nidn && b->idn[lo] == j ? lo : b->nidn;
+}
+
+/* Appends a (keyword << 32 | label) pair to a list of them */
+static int pairs_push(uint64_t **pairs, size_t *n, size_t *cap, uint64_t pair)
+{
+    uint64_t *p;
+
+    if (*n == *cap) {
+        *cap = *cap ? *cap * 2 : 64;
+        if ((p = realloc(*pairs, *cap * sizeof(uint64_t))) == NULL) {
+            return -1;
+        }
+        *pairs = p;
+    }
+    (*pairs)[(*n)++] = pair;
+    return 0;
+}
+
+static int by_pair(const void *a, const void *b)
+{
+    uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+
+    return (x > y) - (x < y);
+}
+
+/*
+ * Collects the (keyword, label) pairs of the block whose skeletons are the same but
+ * whose strings are not, sorted by keyword and then label. A label costs one decode
+ * and one hash probe however many keywords there are.
+ */
+static int workspace_glyphs(typosee_workspace *ws, const typosee_set *set, unsigned int kw_first,
+        unsigned int kw_count, const typosee_batch *b)
+{
+    size_t j, i, n, slot;
+    uint64_t h;
+    uint32_t *tmp;
+    unsigned int k;
+
+    ws->nglyphs = 0;
+    for (j = 0, i = 0; j < b->n; j++) {
+        if (b->len[j] + 1 > ws->skel_cap) {
+            if ((tmp = realloc(ws->skel, (b->len[j] + 1) * sizeof(uint32_t))) == NULL) {
+                return -1;
+            }
+            ws->skel = tmp;
+            ws->skel_cap = b->len[j] + 1;
+        }
+        if (i < b->nidn && b->idn[i] == j) {
+            memcpy(ws->skel, b->cp + b->idn_off[i], b->idn_len[i] * sizeof(uint32_t));
+            n = b->idn_len[i++];
+        }
+        else {
+            n = utf8_decode(b->arena + b->off[j], b->len[j], ws->skel);
+        }
+        if ((n = skeleton(ws->skel, n)) == 0) {
+            continue;
+        }
+        h = skeleton_hash(ws->skel, n);
+        for (slot = h & set->skel_mask; set->skel_table[slot]; slot = (slot + 1) & set->skel_mask) {
+            k = set->skel_table[slot] - 1;
+            if (k < kw_first || k >= kw_first + kw_count || set->skel_hash[k] != h || set->skel_len[k] != n
+                    || memcmp(set->skel + set->skel_off[k], ws->skel, n * sizeof(uint32_t))
+                    || (set->len[k] == b->len[j] && !memcmp(set->arena + set->off[k], b->arena + b->off[j], b->len[j]))) {
+                continue;
+            }
+            if (pairs_push(&ws->glyphs, &ws->nglyphs, &ws->glyphs_cap, (uint64_t)k << 32 | j) < 0) {
+                return -1;
+            }
+        }
+    }
+    if (ws->nglyphs) {
+        qsort(ws->glyphs, ws->nglyphs, sizeof(uint64_t), by_pair);
+    }
+    ws->glyph = ws->glyphs;
+    return 0;
+}
+
+/* Drops the hits the current keyword's glyph run reports instead, and appends that run */
+static int workspace_glyph_hits(typosee_workspace *ws, unsigned int k, size_t *nhits)
+{
+    const uint64_t *end = ws->glyphs + ws->nglyphs;
+    size_t i, g, n = 0;
+
+    while (ws->glyph < end && *ws->glyph >> 32 < k) {
+        ws->glyph++;
+    }
+    for (ws->nglyph = 0; ws->glyph + ws->nglyph < end && ws->glyph[ws->nglyph] >> 32 == k; ws->nglyph++)
+        ;
+    if (ws->nglyph == 0) {
+        return 0;
+    }
+    for (i = 0; i < *nhits; i++) {
+        for (g = 0; g < ws->nglyph && (uint32_t)ws->glyph[g] != ws->hits[i]; g++)
+            ;
+        if (g == ws->nglyph) {
+            ws->hits[n] = ws->hits[i];
+            ws->hit_dist[n++] = ws->hit_dist[i];
+        }
+    }
+    for (g = 0; g < ws->nglyph; g++) {
+        if (workspace_hit(ws, n++, (uint32_t)ws->glyph[g], GLYPH_HIT) < 0) {
+            return -1;
+        }
+    }
+    ws->stats.homoglyphs += ws->nglyph;
+    *nhits = n;
+    return 0;
+}
+
+/* Max-heap of 64-bit keys: moves heap[i] up after it grew, or down after it shrank */
+static void heap_up(uint64_t *heap, size_t i)
+{
+    uint64_t key = heap[i];
+
+    for (; i > 0 && heap[(i - 1) / 2] < key; i = (i - 1) / 2) {
+        heap[i] = heap[(i - 1) / 2];
+    }
+    heap[i] = key;
+}
+
+static void heap_down(uint64_t *heap, size_t n, size_t i)
+{
+    uint64_t key = heap[i];
+    size_t c;
+
+    for (; (c = 2 * i + 1) < n; i = c) {
+        if (c + 1 < n && heap[c + 1] > heap[c]) {
+            c++;
+        }
+        if (heap[c] <= key) {
+            break;
+        }
+        heap[i] = heap[c];
+    }
+    heap[i] = key;
+}
+
+/* Keeps key among the cap smallest offered to the heap so far */
+static void heap_offer(uint64_t *heap, size_t *n, size_t cap, uint64_t key)
+{
+    if (*n < cap) {
+        heap[*n] = key;
+        heap_up(heap, (*n)++);
+    }
+    else if (key < heap[0]) {
+        heap[0] = key;
+        heap_down(heap, *n, 0);
+    }
+}
+
+/*
+ * A hit for label and for each later label with its text, which the batch folded into
+ * it. With the k closest labels asked for they go to the keyword's heap instead, and
+ * once it is full its worst distance is the bound the labels still to come are held to.
+ */
+static int workspace_hit_copies(typosee_workspace *ws, const typosee_batch *b, size_t *n, uint32_t label,
+        uint32_t distance)
+{
+    for (; label != UINT32_MAX; label = b->same[label]) {
+        if (ws->top == TYPOSEE_TOP_LABELS) {
+            heap_offer(ws->heap, &ws->nheap, ws->top_k, (uint64_t)distance << 32 | label);
+            ws->bound = ws->nheap == ws->top_k ? ws->heap[0] >> 32 : ws->bound;
+        }
+        else if (workspace_hit(ws, (*n)++, label, distance) < 0) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/*
+ * Collects the (keyword, label) pairs of the block whose strings are the same, sorted
+ * by keyword and then label: a perfect-hash probe per distinct label, by the hash it
+ * was added with, and for the punycode ones a compare on code points per keyword.
+ */
+static int workspace_exacts(typosee_workspace *ws, const typosee_set *set, unsigned int kw_first,
+        unsigned int kw_count, const typosee_batch *b)
+{
+    size_t i, d;
+    uint32_t j, k, l;
+
+    ws->nexacts = 0;
+    for (i = 0; i < b->nunique; i++) {
+        j = b->order[i];
+        for (k = set_exact_find(set, b->hash[j], b->arena + b->off[j], b->len[j]); k != UINT32_MAX; k = set->exact_next[k]) {
+            for (l = j; k >= kw_first && k < kw_first + kw_count && l != UINT32_MAX; l = b->same[l]) {
+                if (pairs_push(&ws->exacts, &ws->nexacts, &ws->exacts_cap, (uint64_t)k << 32 | l) < 0) {
+                    return -1;
+                }
+            }
+        }
+    }
+    ws->stats.exact_lookups += b->nunique;
+    for (d = 0; d < b->nidn; d++) {
+        for (k = kw_first; k < kw_first + kw_count; k++) {
+            if (set->cp_len[k] == b->idn_len[d]
+                    && !memcmp(set->cp + set->cp_off[k], b->cp + b->idn_off[d], b->idn_len[d] * sizeof(uint32_t))
+                    && pairs_push(&ws->exacts, &ws->nexacts, &ws->exacts_cap, (uint64_t)k << 32 | b->idn[d]) < 0) {
+                return -1;
+            }
+        }
+    }
+    if (ws->nexacts) {
+        qsort(ws->exacts, ws->nexacts, sizeof(uint64_t), by_pair);
+    }
+    ws->exact = ws->exacts;
+    return 0;
+}
+
+/* Hits for the current keyword's run of exact pairs */
+static int workspace_exact_hits(typosee_workspace *ws, const typosee_batch *b, unsigned int k, size_t *nhits)
+{
+    const uint64_t *end = ws->exacts + ws->nexacts;
+
+    while (ws->exact < end && *ws->exact >> 32 < k) {
+        ws->exact++;
+    }
+    for (; ws->exact < end && *ws->exact >> 32 == k; ws->exact++) {
+        if (workspace_hit(ws, (*nhits)++, (uint32_t)*ws->exact, 0) < 0) {
+            return -1;
+        }
+    }
+    ws->stats.repeats += b->n - b->nidn - b->nunique;
+    return 0;
+}
+
+/*
+ * Whether the anchor's distance to label j puts it beyond the current keyword's bound:
+ * d(label, k) >= |d(label, anchor) - d(anchor, k)|, as Levenshtein distance is a metric.
+ */
+static int workspace_pruned(const typosee_workspace *ws, uint32_t j)
+{
+    uint32_t d = ws->tri_from[j];
+
+    return d != TRI_UNKNOWN && (d > ws->tri_d + ws->bound || ws->tri_d > d + ws->bound);
+}
+
+/* Room in ws->lanes for the weighted kernel's vectors for a keyword of len1 characters */
+static int workspace_lanes_reserve(typosee_workspace *ws, size_t len1)
+{
+    size_t rows = 2 * ws->kernel->lanes, bytes = (256 + 7) * ((len1 + rows) / rows) * rows * sizeof(int32_t);
+    void *p;
+
+    if (bytes > ws->lanes_cap) {
+        /* the kernel loads whole vectors, up to an AVX-512 register, from their own alignment */
+        if ((p = aligned_alloc(64, (bytes + 63) & ~(size_t)63)) == NULL) {
+            return -1;
+        }
+        free(ws->lanes);
+        ws->lanes = p;
+        ws->lanes_cap = bytes;
+    }
+    return 0;
+}
+
+/* How far apart in length a keyword and a label within bound can be */
+static size_t workspace_slack(const typosee_workspace *ws, uint32_t bound)
+{
+    return !ws->costs ? bound : ws->costs->min_indel ? bound / ws->costs->min_indel : UINT32_MAX;
+}
+
+/* The bound went down: labels from *next on that are now too short are skipped, and *last drops those now too long */
+static void workspace_tighten(const typosee_workspace *ws, const typosee_batch *batch, size_t len1,
+        size_t *next, size_t *last)
+{
+    size_t slack = workspace_slack(ws, ws->bound), skip;
+
+    skip = batch_lower_bound(batch, len1 > slack ? len1 - slack : 0);
+    *next = skip > *next ? skip : *next;
+    if (!ws->substring) {
+        skip = batch_lower_bound(batch, len1 + slack + 1);
+        *last = skip < *last ? skip : *last;
+    }
+}
+
+/*
+ * Hits for the labels within the threshold of keyword k: the byte ones through the
+ * kernel, the weighted one under edit costs, or the banded recurrence for what
+ * neither takes, one of each text and only those of a length the bound allows; the
+ * punycode ones on code points. For the k closest labels the bound comes down as the
+ * keyword's heap fills, and the window of lengths and the band narrow with it.
+ */
+static int workspace_distances(typosee_workspace *ws, const typosee_set *set, unsigned int k,
+        const typosee_batch *batch, unsigned int threshold, size_t *nhits)
+{
+    unsigned int l, n, distance;
+    uint32_t dist[MAX_LANES], lane[MAX_LANES], j, bound;
+    size_t i, next, first, last, len1 = set->len[k], cp_len = set->cp_len[k], end, slack, covered = 0, tried = 0, pruned = 0;
+    const uint32_t *cp = set->cp + set->cp_off[k], *idx;
+    const char *str1 = set->arena + set->off[k];
+    int rc, columns;
+
+    ws->bound = bound = threshold;
+    ws->nheap = 0;
+    slack = workspace_slack(ws, bound);
+
+    /* The distance is never less than the difference in length; a substring search only bounds it from below */
+    first = batch_lower_bound(batch, len1 > slack ? len1 - slack : 0);
+    last = ws->substring ? batch->nunique : batch_lower_bound(batch, len1 + slack + 1);
+    workspace_lap(ws, &ws->stats.filter);
+
+    if (len1 >= 1 && len1 <= 64 && !ws->costs) {
+        /* Lanes are packed in length order, so each vector holds labels of one or two lengths */
+        peq_build(ws->peq, str1, len1);
+        for (i = first; i < last; i = next) {
+            if (ws->tri_from) {
+                /* Labels the anchor's distances rule out don't take a lane */
+                for (n = 0, next = i; next < last && n < ws->kernel->lanes; next++) {
+                    if (workspace_pruned(ws, batch->order[next])) {
+                        pruned += batch->upto[next + 1] - batch->upto[next];
+                    }
+                    else {
+                        lane[n++] = batch->order[next];
+                        covered += batch->upto[next + 1] - batch->upto[next];
+                    }
+                }
+                idx = lane;
+            }
+            else {
+                n = last - i < ws->kernel->lanes ? last - i : ws->kernel->lanes;
+                idx = batch->order + i;
+                next = i + n;
+                covered += batch->upto[next] - batch->upto[i];
+            }
+            if (n) {
+                ws->kernel->myers[ws->substring | ws->osa << 1](ws, len1, batch, idx, n, dist);
+            }
+            for (l = 0; l < n; l++) {
+                if (ws->tri_save) {
+                    ws->tri_save[idx[l]] = dist[l] < TRI_UNKNOWN ? dist[l] : TRI_UNKNOWN;
+                }
+                if (dist[l] <= ws->bound && workspace_hit_copies(ws, batch, nhits, idx[l], dist[l]) < 0) {
+                    return -1;
+                }
+            }
+            tried += n;
+            if (ws->bound < bound) {
+                bound = ws->bound;
+                workspace_tighten(ws, batch, len1, &next, &last);
+            }
+        }
+    }
+    else {
+        /* Weighted edits take the column kernel where there is one, laid out once for the keyword, up to the same length as Myers' */
+        columns = ws->costs && !ws->substring && len1 >= 1 && len1 <= 64 && ws->kernel->weighted_keyword;
+        if (columns) {
+            if (workspace_lanes_reserve(ws, len1) < 0) {
+                return -1;
+            }
+            ws->kernel->weighted_keyword(ws, str1, len1);
+        }
+        for (i = first; i < last; i = next) {
+            j = batch->order[i];
+            next = i + 1;
+            if (ws->tri_from && workspace_pruned(ws, j)) {
+                pruned += batch->upto[next] - batch->upto[i];
+                continue;
+            }
+            rc = 0;
+            if (ws->substring) {
+                rc = workspace_search(ws, str1, len1, batch->arena + batch->off[j], batch->len[j], 0, 0, &distance, &end);
+            }
+            else if (columns) {
+                ws->kernel->weighted[ws->osa](ws, len1, batch->arena + batch->off[j], batch->len[j], ws->bound, &distance);
+            }
+            else {
+                rc = workspace_bounded(ws, str1, len1, batch->arena + batch->off[j], batch->len[j], 0, ws->bound, &distance);
+            }
+            if (rc < 0) {
+                return -1;
+            }
+            if (ws->tri_save && distance <= ws->bound) {
+                ws->tri_save[j] = distance < TRI_UNKNOWN ? distance : TRI_UNKNOWN;
+            }
+            if (distance <= ws->bound && workspace_hit_copies(ws, batch, nhits, j, distance) < 0) {
+                return -1;
+            }
+            covered += batch->upto[next] - batch->upto[i];
+            tried++;
+            if (ws->bound < bound) {
+                bound = ws->bound;
+                workspace_tighten(ws, batch, len1, &next, &last);
+            }
+        }
+        ws->stats.matrix_pairs += tried;
+    }
+    ws->stats.length_rejects += batch->n - batch->nidn - covered - pruned;
+    ws->stats.triangle_skips += pruned;
+    ws->stats.repeats += covered - tried;
+
+    /* Punycode labels are few and need no kernel of their own: the banded recurrence on code points */
+    for (i = 0; i < batch->nidn; i++) {
+        if ((batch->idn_len[i] > cp_len ? (ws->substring ? 0 : batch->idn_len[i] - cp_len) : cp_len - batch->idn_len[i])
+                > workspace_slack(ws, ws->bound)) {
+            ws->stats.length_rejects++;
+            continue;
+        }
+        rc = ws->substring
+            ? workspace_search(ws, cp, cp_len, batch->cp + batch->idn_off[i], batch->idn_len[i], 1, 0, &distance, &end)
+            : workspace_bounded(ws, cp, cp_len, batch->cp + batch->idn_off[i], batch->idn_len[i], 1, ws->bound, &distance);
+        if (rc < 0) {
+            return -1;
+        }
+        if (distance <= ws->bound && workspace_hit_copies(ws, batch, nhits, batch->idn[i], distance) < 0) {
+            return -1;
+        }
+        ws->stats.idn_pairs++;
+    }
+    for (i = 0; i < ws->nheap; i++) {
+        if (workspace_hit(ws, (*nhits)++, (uint32_t)ws->heap[i], ws->heap[i] >> 32) < 0) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/* Hands the keyword's hits to the callback in label order; only they pay for a full matrix, to read their edit script back, and only if asked */
+static int workspace_report(const typosee_set *set, unsigned int k, typosee_workspace *ws, const typosee_batch *batch,
+        size_t nhits, typosee_match_cb cb, void *ctx)
+{
+    typosee_match m;
+    unsigned int distance;
+    size_t i, idn, len1 = set->len[k];
+    const char *str1 = set->arena + set->off[k];
+    int rc;
+
+    if (ws->homoglyphs && workspace_glyph_hits(ws, k, &nhits) < 0) {
+        return -1;
+    }
+    workspace_sort_hits(ws, nhits);
+    ws->stats.matches += nhits;
+
+    m.keyword = k;
+    for (i = 0; i < nhits; i++) {
+        m.label = ws->hits[i];
+        m.distance = ws->hit_dist[i];
+        m.script = NULL;
+        m.edits = 0;
+        m.offset = 0;
+        m.length = batch->len[m.label];
+        m.homoglyph = m.distance == GLYPH_HIT;
+        idn = batch_idn(batch, m.label);
+        if (m.homoglyph) {
+            m.distance = 0;
+        }
+        else if (ws->substring && workspace_locate(ws, set, k, batch, m.label, idn, &m) < 0) {
+            return -1;
+        }
+        if (!m.homoglyph && ws->scripts && len1 && m.length && idn == batch->nidn) {
+            if (workspace_distance(ws, str1, len1, batch->arena + batch->off[m.label] + m.offset, m.length, &distance) < 0
+                    || workspace_script(ws, ws->rows, len1, m.length, &m.edits) < 0) {
+                return -1;
+            }
+            m.script = ws->script;
+        }
+        workspace_lap(ws, &ws->stats.distance);
+        rc = cb(&m, ctx);
+        workspace_lap(ws, &ws->stats.callback);
+        if (rc != 0) {
+            return rc;
+        }
+    }
+    workspace_lap(ws, &ws->stats.distance);
+    return 0;
+}
+
+/*
+ * Gives each keyword of the block that anchors a later one there a row for its
+ * distances to the batch's labels. Only plain edit distance is a metric the pruning
+ * can lean on: not with transpositions (OSA breaks the triangle inequality), edit
+ * costs (insertions and deletions can differ) or substring search. Returns 0 with no
+ * rows if the block doesn't qualify, -1 if out of memory.
+ */
+static int workspace_triangles(typosee_workspace *ws, const typosee_set *set, unsigned int kw_first,
+        unsigned int kw_count, const typosee_batch *batch)
+{
+    unsigned int k, a, nrows = 0;
+    void *p;
+
+    ws->tri_save = NULL;
+    ws->tri_from = NULL;
+    if (!set->anchor || ws->osa || ws->costs || ws->substring) {
+        return 0;
+    }
+    if (kw_count > ws->tri_slot_cap) {
+        if ((p = realloc(ws->tri_slot, kw_count * sizeof(uint32_t))) == NULL) {
+            return -1;
+        }
+        ws->tri_slot = p;
+        ws->tri_slot_cap = kw_count;
+    }
+    for (k = 0; k < kw_count; k++) {
+        ws->tri_slot[k] = UINT32_MAX;
+    }
+    for (k = kw_first; k < kw_first + kw_count; k++) {
+        a = set->anchor[k];
+        if (a != UINT32_MAX && a >= kw_first && ws->tri_slot[a - kw_first] == UINT32_MAX) {
+            ws->tri_slot[a - kw_first] = nrows++;
+        }
+    }
+    if (nrows * batch->n > ws->tri_cap) {
+        if ((p = realloc(ws->tri, nrows * batch->n)) == NULL) {
+            return -1;
+        }
+        ws->tri = p;
+        ws->tri_cap = nrows * batch->n;
+    }
+    if (nrows && batch->n) {
+        memset(ws->tri, TRI_UNKNOWN, nrows * batch->n);
+    }
+    return nrows;
+}
+
+/* Points the workspace at keyword k's own row, and at its anchor's if that is in the block */
+static void workspace_triangle(typosee_workspace *ws, const typosee_set *set, unsigned int k, unsigned int kw_first,
+        const typosee_batch *batch)
+{
+    uint32_t a = set->anchor[k];
+
+    ws->tri_save = ws->tri_slot[k - kw_first] != UINT32_MAX ? ws->tri + ws->tri_slot[k - kw_first] * batch->n : NULL;
+    ws->tri_from = a != UINT32_MAX && a >= kw_first ? ws->tri + ws->tri_slot[a - kw_first] * batch->n : NULL;
+    ws->tri_d = a != UINT32_MAX ? set->anchor_dist[k] : 0;
+}
+
+/* Scratch for top-k: the keyword's heap, and a heap per label of the batch */
+static int workspace_top_reserve(typosee_workspace *ws, const typosee_batch *batch)
+{
+    void *p;
+
+    if (ws->top_k > ws->heap_cap) {
+        if ((p = realloc(ws->heap, ws->top_k * sizeof(uint64_t))) == NULL) {
+            return -1;
+        }
+        ws->heap = p;
+        ws->heap_cap = ws->top_k;
+    }
+    if (ws->top == TYPOSEE_TOP_KEYWORDS && batch->n * ws->top_k > ws->label_cap) {
+        if ((p = realloc(ws->label_heap, batch->n * ws->top_k * sizeof(uint64_t))) == NULL) {
+            return -1;
+        }
+        ws->label_heap = p;
+        if ((p = realloc(ws->label_nheap, batch->n * sizeof(uint32_t))) == NULL) {
+            return -1;
+        }
+        ws->label_nheap = p;
+        ws->label_cap = batch->n * ws->top_k;
+    }
+    if (ws->top == TYPOSEE_TOP_KEYWORDS) {
+        memset(ws->label_nheap, 0, batch->n * sizeof(uint32_t));
+    }
+    return 0;
+}
+
+/* Offers the keyword's hits to the heaps of their labels; keywords come in index order, so ties stay with the first */
+static void workspace_label_offer(typosee_workspace *ws, unsigned int k, size_t nhits)
+{
+    size_t i, n;
+    uint32_t j;
+
+    for (i = 0; i < nhits; i++) {
+        j = ws->hits[i];
+        n = ws->label_nheap[j];
+        heap_offer(ws->label_heap + (size_t)j * ws->top_k, &n, ws->top_k, (uint64_t)ws->hit_dist[i] << 32 | k);
+        ws->label_nheap[j] = n;
+    }
+}
+
+/* What the label heaps kept, regrouped as (keyword << 32 | label) pairs, sorted */
+static int workspace_label_picks(typosee_workspace *ws, const typosee_batch *batch)
+{
+    size_t j, e;
+    const uint64_t *heap;
+
+    ws->npicks = 0;
+    for (j = 0; j < batch->n; j++) {
+        heap = ws->label_heap + j * ws->top_k;
+        for (e = 0; e < ws->label_nheap[j]; e++) {
+            if (pairs_push(&ws->picks, &ws->npicks, &ws->picks_cap, (heap[e] & 0xffffffff) << 32 | j) < 0) {
+                return -1;
+            }
+        }
+    }
+    qsort(ws->picks, ws->npicks, sizeof(uint64_t), by_pair);
+    return 0;
+}
+
+/* The distance label's heap holds for keyword k */
+static uint32_t workspace_label_distance(const typosee_workspace *ws, uint32_t j, unsigned int k)
+{
+    const uint64_t *heap = ws->label_heap + (size_t)j * ws->top_k;
+    size_t e;
+
+    for (e = 0; (uint32_t)heap[e] != k; e++)
+        ;
+    return heap[e] >> 32;
+}
+
+int typosee_match_block(const typosee_set *set, unsigned int kw_first, unsigned int kw_count,
+        typosee_workspace *ws, const typosee_batch *batch,
+        unsigned int threshold, typosee_match_cb cb, void *ctx)
+{
+    unsigned int k, cheapest, bound;
+    size_t nhits, p;
+    int rc, exact, triangles;
+
+    if (!batch->sealed || (ws->top && workspace_top_reserve(ws, batch) < 0)
+            || (triangles = workspace_triangles(ws, set, kw_first, kw_count, batch)) < 0) {
+        return -1;
+    }
+    /* Below the cheapest edit only the keywords themselves match, which the perfect hash finds without a distance */
+    cheapest = !ws->costs ? 1 : ws->osa && ws->costs->swap < ws->costs->min_edit ? ws->costs->swap : ws->costs->min_edit;
+    for (k = kw_first, exact = 0; k < kw_first + kw_count && !exact; k++) {
+        exact = workspace_keyword_bound(ws, set, k, threshold) < cheapest && !ws->substring && set->exact_seed;
+    }
+    workspace_lap(ws, NULL);
+    if (exact) {
+        if (workspace_exacts(ws, set, kw_first, kw_count, batch) < 0) {
+            return -1;
+        }
+        workspace_lap(ws, &ws->stats.filter);
+    }
+    if (ws->homoglyphs) {
+        if (workspace_glyphs(ws, set, kw_first, kw_count, batch) < 0) {
+            return -1;
+        }
+        workspace_lap(ws, &ws->stats.filter);
+    }
+    for (k = kw_first; k < kw_first + kw_count; k++) {
+        ws->stats.pairs += batch->n;
+        nhits = 0;
+        bound = workspace_keyword_bound(ws, set, k, threshold);
+        if (triangles) {
+            workspace_triangle(ws, set, k, kw_first, batch);
+        }
+        rc = exact && bound < cheapest ? workspace_exact_hits(ws, batch, k, &nhits)
+            : workspace_distances(ws, set, k, batch, bound, &nhits);
+        if (rc < 0) {
+            return -1;
+        }
+        if (exact && bound < cheapest && ws->top == TYPOSEE_TOP_LABELS && nhits > ws->top_k) {
+            nhits = ws->top_k;          /* all at 0, so the first labels win */
+        }
+        if (ws->top == TYPOSEE_TOP_KEYWORDS) {
+            workspace_label_offer(ws, k, nhits);
+        }
+        else if ((rc = workspace_report(set, k, ws, batch, nhits, cb, ctx)) != 0) {
+            return rc;
+        }
+    }
+    if (ws->top != TYPOSEE_TOP_KEYWORDS) {
+        return 0;
+    }
+
+    /* Every keyword has been past every label; what each label kept is reported keyword by keyword */
+    if (workspace_label_picks(ws, batch) < 0) {
+        return -1;
+    }
+    for (k = kw_first, p = 0; k < kw_first + kw_count; k++) {
+        for (nhits = 0; p < ws->npicks && ws->picks[p] >> 32 == k; p++, nhits++) {
+            if (workspace_hit(ws, nhits, (uint32_t)ws->picks[p], workspace_label_distance(ws, (uint32_t)ws->picks[p], k)) < 0) {
+                return -1;
+            }
+        }
+        if ((rc = workspace_report(set, k, ws, batch, nhits, cb, ctx)) != 0) {
+            return rc;
+        }
+    }
+    return 0;
+}
+
+int typosee_match_batch(const typosee_set *set, typosee_workspace *ws, const typosee_batch *batch,
+        unsigned int threshold, typosee_match_cb cb, void *ctx)
+{
+    return typosee_match_block(set, 0, set->count, ws, batch, threshold, cb, ctx);
+}
+
+/* QWERTY rows; each row sits half a key to the right of the one above it */
+static const char *const keyboard_rows[] = { "1234567890-", "qwertyuiop", "asdfghjkl", "zxcvbnm" };
+
+static void costs_pair(typosee_costs *costs, unsigned char a, unsigned char b, uint8_t cost)
+{
+    costs->sub[a][b] = costs->sub[b][a] = cost;
+}
+
+static void costs_keyboard(typosee_costs *costs, uint8_t cost)
+{
+    const char *row, *up;
+    size_t r, i;
+
+    for (r = 0; r < sizeof(keyboard_rows) / sizeof(keyboard_rows[0]); r++) {
+        row = keyboard_rows[r];
+        up = r ? keyboard_rows[r - 1] : "";
+        for (i = 0; row[i]; i++) {
+            if (row[i + 1]) {
+                costs_pair(costs, row[i], row[i + 1], cost);
+            }
+            if (i < strlen(up)) {
+                costs_pair(costs, row[i], up[i], cost);
+            }
+            if (i + 1 < strlen(up)) {
+                costs_pair(costs, row[i], up[i + 1], cost);
+            }
+        }
+    }
+}
+
+/* A decimal number of edits ("0.5") in cost units */
+static int costs_value(const char *text, uint8_t *out)
+{
+    char *end;
+    double v = strtod(text, &end);
+
+    if (end == text || *end || v < 0 || v * TYPOSEE_COST_UNIT + 0.5 > 255) {
+        return -1;
+    }
+    *out = (uint8_t)(v * TYPOSEE_COST_UNIT + 0.5);
+    return 0;
+}
+
+/* One rule; "*" stands for every character and sets the default for code points past 0xff too */
+static int costs_rule(typosee_costs *costs, const char *line)
+{
+    char op[16], a[16], b[16], c[16];
+    int n = sscanf(line, "%15s %15s %15s %15s", op, a, b, c);
+    uint8_t v, *table;
+
+    if (n <= 0 || op[0] == '#') {
+        return 0;
+    }
+    if (n == 2 && !strcmp(op, "keyboard") && !costs_value(a, &v)) {
+        costs_keyboard(costs, v);
+    }
+    else if (n == 2 && !strcmp(op, "swap") && !costs_value(a, &v)) {
+        costs->swap = v;
+    }
+    else if (n == 3 && !strcmp(op, "sub") && !strcmp(a, "*") && !costs_value(b, &v)) {
+        memset(costs->sub, v, sizeof(costs->sub));
+        costs->sub_default = v;
+    }
+    else if (n == 4 && !strcmp(op, "sub") && !a[1] && !b[1] && !costs_value(c, &v)) {
+        costs_pair(costs, a[0], b[0], v);
+    }
+    else if (n == 3 && (!strcmp(op, "ins") || !strcmp(op, "del")) && !a[1] && !costs_value(b, &v)) {
+        table = op[0] == 'i' ? costs->ins : costs->del;
+        if (!strcmp(a, "*")) {
+            memset(table, v, 256);
+            *(op[0] == 'i' ? &costs->ins_default : &costs->del_default) = v;
+        }
+        else {
+            table[(unsigned char)a[0]] = v;
+        }
+    }
+    else {
+        return -1;
+    }
+    return 0;
+}
+
+typosee_costs *typosee_costs_parse(const char *text, size_t len)
+{
+    typosee_costs *costs = malloc(sizeof(typosee_costs));
+    char line[256];
+    size_t i, n;
+    unsigned int x;
+
+    if (costs == NULL) {
+        return NULL;
+    }
+    memset(costs->sub, TYPOSEE_COST_UNIT, sizeof(costs->sub));
+    memset(costs->ins, TYPOSEE_COST_UNIT, sizeof(costs->ins));
+    memset(costs->del, TYPOSEE_COST_UNIT, sizeof(costs->del));
+    costs->sub_default = costs->ins_default = costs->del_default = costs->swap = TYPOSEE_COST_UNIT;
+    for (i = 0; i < len; i += n + 1) {
+        for (n = 0; i + n < len && text[i + n] != '\n'; n++)
+            ;
+        if (n >= sizeof(line)) {
+            free(costs);
+            return NULL;
+        }
+        memcpy(line, text + i, n);
+        line[n] = 0x0;
+        if (costs_rule(costs, line) < 0) {
+            free(costs);
+            return NULL;
+        }
+    }
+    costs->min_indel = costs->ins_default < costs->del_default ? costs->ins_default : costs->del_default;
+    for (x = 0; x < 256; x++) {
+        costs->min_indel = costs->ins[x] < costs->min_indel ? costs->ins[x] : costs->min_indel;
+        costs->min_indel = costs->del[x] < costs->min_indel ? costs->del[x] : costs->min_indel;
+    }
+    costs->min_edit = costs->sub_default < costs->min_indel ? costs->sub_default : costs->min_indel;
+    for (x = 0; x < 256 * 256; x++) {
+        if (x / 256 != x % 256 && costs->sub[x / 256][x % 256] < costs->min_edit) {
+            costs->min_edit = costs->sub[x / 256][x % 256];
+        }
+    }
+    return costs;
+}
+
+typosee_costs *typosee_costs_load(const char *path)
+{
+    typosee_costs *costs = NULL;
+    char *text;
+    long len;
+    FILE *fp;
+
+    if ((fp = fopen(path, "rb")) == NULL) {
+        return NULL;
+    }
+    if (fseek(fp, 0, SEEK_END) == 0 && (len = ftell(fp)) >= 0 && fseek(fp, 0, SEEK_SET) == 0
+            && (text = malloc(len + 1)) != NULL) {
+        if (fread(text, 1, len, fp) == (size_t)len) {
+            costs = typosee_costs_parse(text, len);
+        }
+        free(text);
+    }
+    fclose(fp);
+    return costs;
+}
+
+void typosee_costs_free(typosee_costs *costs)
+{
+    free(costs);
+}
+
+/*
+ * Public Suffix List. The rules are compiled into a trie keyed by labels from the
+ * right ("uk" -> "co"), laid out flat so the same bytes work in memory and as a file
+ * to mmap: a header, the nodes (each node's children contiguous and sorted by label,
+ * node 0 the root), then the pool the labels point into. The image is in host byte
+ * order.
+ */
+#define PSL_MAGIC       "TYPOPSL1"
+#define PSL_RULE        1               /* the labels down to here are a public suffix */
+#define PSL_WILDCARD    2               /* so is any one label below this node */
+#define PSL_EXCEPTION   4               /* but not this one: the suffix ends at the parent */
+#define PSL_MAX_LABEL   255
+
+struct psl_header {
+    char magic[8];
+    uint32_t nodes;
+    uint32_t pool;
+};
+
+struct psl_node {
+    uint32_t label;                     /* offset into the pool */
+    uint32_t child;                     /* first child */
+    uint16_t nchild;
+    uint8_t len;
+    uint8_t flags;
+};
+
+struct typosee_psl {
+    const struct psl_node *node;
+    const char *pool;
+    void *image;
+    size_t image_len;
+    int mapped;
+};
+
+/* The trie while it is being built: children as sibling lists */
+struct psl_build {
+    struct psl_tmp {
+        uint32_t label;
+        uint32_t first;
+        uint32_t next;
+        uint32_t flat;                  /* index in the compiled image */
+        uint8_t len;
+        uint8_t flags;
+    } *node;
+    size_t nodes;
+    size_t nodes_cap;
+    char *pool;
+    size_t pool_len;
+    size_t pool_cap;
+};
+
+static int psl_label_cmp(const char *a, size_t alen, const char *b, size_t blen)
+{
+    int c = memcmp(a, b, alen < blen ? alen : blen);
+
+    return c ? c : (alen > blen) - (alen < blen);
+}
+
+/* Child of node `parent` labelled label[0..len), created if need be; -1 if out of memory */
+static int64_t psl_build_child(struct psl_build *t, uint32_t parent, const char *label, size_t len)
+{
+    uint32_t i;
+    void *p;
+
+    for (i = t->node[parent].first; i; i = t->node[i].next) {
+        if (!psl_label_cmp(t->pool + t->node[i].label, t->node[i].len, label, len)) {
+            return i;
+        }
+    }
+    if (t->nodes == t->nodes_cap) {
+        t->nodes_cap *= 2;
+        if ((p = realloc(t->node, t->nodes_cap * sizeof(*t->node))) == NULL) {
+            return -1;
+        }
+        t->node = p;
+    }
+    if (t->pool_len + len > t->pool_cap) {
+        t->pool_cap = (t->pool_len + len) * 2;
+        if ((p = realloc(t->pool, t->pool_cap)) == NULL) {
+            return -1;
+        }
+        t->pool = p;
+    }
+    memcpy(t->pool + t->pool_len, label, len);
+    i = t->nodes++;
+    t->node[i].label = t->pool_len;
+    t->node[i].len = len;
+    t->node[i].flags = 0;
+    t->node[i].first = 0;
+    t->node[i].next = t->node[parent].first;
+    t->node[parent].first = i;
+    t->pool_len += len;
+    return i;
+}
+
+/* Adds one rule such as "co.uk", "*.ck" or "!www.ck", lower-cased, walking its labels from the right */
+static int psl_build_rule(struct psl_build *t, char *rule, size_t len)
+{
+    uint8_t flags = PSL_RULE;
+    int64_t n = 0;
+    size_t end, start;
+
+    if (*rule == '!') {
+        flags = PSL_EXCEPTION;
+        rule++;
+        len--;
+    }
+    for (end = len; end > 0; end = start ? start - 1 : 0) {
+        for (start = end; start > 0 && rule[start - 1] != '.'; start--)
+            ;
+        if (end - start > PSL_MAX_LABEL || end == start) {
+            return 0;                   /* not a rule we can use */
+        }
+        if (start == 0 && end - start == 1 && rule[0] == '*') {
+            t->node[n].flags |= PSL_WILDCARD;
+            return 0;
+        }
+        if ((n = psl_build_child(t, n, rule + start, end - start)) < 0) {
+            return -1;
+        }
+        if (start == 0) {
+            break;
+        }
+    }
+    t->node[n].flags |= flags;
+    return 0;
+}
+
+/* Insertion sort of a node's children by label; the lists are built once and most are short */
+static void psl_build_sort(const struct psl_build *t, uint32_t *kids, uint32_t n)
+{
+    const struct psl_tmp *x, *y;
+    uint32_t i, j, k;
+
+    for (i = 1; i < n; i++) {
+        k = kids[i];
+        x = &t->node[k];
+        for (j = i; j > 0; j--) {
+            y = &t->node[kids[j - 1]];
+            if (psl_label_cmp(t->pool + y->label, y->len, t->pool + x->label, x->len) <= 0) {
+                break;
+            }
+            kids[j] = kids[j - 1];
+        }
+        kids[j] = k;
+    }
+}
+
+/* Breadth first, so every node's children land next to each other, sorted for binary search */
+static typosee_psl *psl_flatten(struct psl_build *t)
+{
+    struct psl_header *h;
+    struct psl_node *out;
+    typosee_psl *psl;
+    uint32_t *queue, *kids, head = 0, tail = 1, i, n, k, nk;
+    size_t size = sizeof(*h) + t->nodes * sizeof(*out) + t->pool_len;
+
+    queue = malloc(t->nodes * sizeof(uint32_t));
+    kids = malloc(t->nodes * sizeof(uint32_t));
+    psl = calloc(1, sizeof(*psl));
+    h = calloc(1, size);
+    if (!queue || !kids || !psl || !h) {
+        free(queue);
+        free(kids);
+        free(psl);
+        free(h);
+        return NULL;
+    }
+    memcpy(h->magic, PSL_MAGIC, 8);
+    h->nodes = t->nodes;
+    h->pool = t->pool_len;
+    out = (struct psl_node *)(h + 1);
+    memcpy(out + t->nodes, t->pool, t->pool_len);
+
+    queue[0] = 0;
+    t->node[0].flat = 0;
+    while (head < tail) {
+        n = queue[head];
+        for (nk = 0, k = t->node[n].first; k; k = t->node[k].next) {
+            kids[nk++] = k;
+        }
+        psl_build_sort(t, kids, nk);
+        out[head].label = t->node[n].label;
+        out[head].len = t->node[n].len;
+        out[head].flags = t->node[n].flags;
+        out[head].child = tail;
+        out[head].nchild = nk;
+        for (i = 0; i < nk; i++) {
+            queue[tail++] = kids[i];
+        }
+        head++;
+    }
+    free(queue);
+    free(kids);
+
+    psl->image = h;
+    psl->image_len = size;
+    psl->node = out;
+    psl->pool = (const char *)(out + t->nodes);
+    return psl;
+}
+
+static typosee_psl *psl_compile(FILE *fp)
+{
+    struct psl_build t;
+    typosee_psl *psl = NULL;
+    char line[1024], *rule, *p;
+    size_t len;
+
+    memset(&t, 0, sizeof(t));
+    t.nodes_cap = 1024;
+    t.pool_cap = 8192;
+    t.node = malloc(t.nodes_cap * sizeof(*t.node));
+    t.pool = malloc(t.pool_cap);
+    if (!t.node || !t.pool) {
+        goto out;
+    }
+    memset(t.node, 0, sizeof(*t.node));
+    t.nodes = 1;
+
+    /* One rule per line, up to the first white space; "//" starts a comment */
+    while (fgets(line, sizeof(line), fp) != NULL) {
+        for (rule = line; *rule == ' ' || *rule == '\t'; rule++)
+            ;
+        for (p = rule; *p && *p != ' ' && *p != '\t' && *p != '\r' && *p != '\n'; p++) {
+            if (*p >= 'A' && *p <= 'Z') {
+                *p += 'a' - 'A';
+            }
+        }
+        len = p - rule;
+        if (len == 0 || (len >= 2 && rule[0] == '/' && rule[1] == '/')) {
+            continue;
+        }
+        if (psl_build_rule(&t, rule, len) < 0) {
+            goto out;
+        }
+    }
+    if (t.nodes > UINT32_MAX / 2) {
+        goto out;
+    }
+    psl = psl_flatten(&t);
+out:
+    free(t.node);
+    free(t.pool);
+    return psl;
+}
+
+/* A compiled image is mapped as it is, after a check that it is self-consistent */
+static typosee_psl *psl_map(FILE *fp)
+{
+    const struct psl_header *h;
+    const struct psl_node *node;
+    typosee_psl *psl;
+    struct stat st;
+    uint32_t i;
+    void *map;
+
+    if (fstat(fileno(fp), &st) < 0 || (size_t)st.st_size < sizeof(*h)) {
+        return NULL;
+    }
+    if ((map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fileno(fp), 0)) == MAP_FAILED) {
+        return NULL;
+    }
+    h = map;
+    node = (const struct psl_node *)(h + 1);
+    if (h->nodes == 0 || (size_t)st.st_size != sizeof(*h) + (size_t)h->nodes * sizeof(*node) + h->pool) {
+        goto bad;
+    }
+    for (i = 0; i < h->nodes; i++) {
+        if ((uint64_t)node[i].label + node[i].len > h->pool
+                || (uint64_t)node[i].child + node[i].nchild > h->nodes) {
+            goto bad;
+        }
+    }
+    if ((psl = calloc(1, sizeof(*psl))) == NULL) {
+        goto bad;
+    }
+    psl->image = map;
+    psl->image_len = st.st_size;
+    psl->mapped = 1;
+    psl->node = node;
+    psl->pool = (const char *)(node + h->nodes);
+    return psl;
+bad:
+    munmap(map, st.st_size);
+    return NULL;
+}
+
+typosee_psl *typosee_psl_load(const char *path)
+{
+    typosee_psl *psl;
+    char magic[8];
+    FILE *fp;
+
+    if ((fp = fopen(path, "rb")) == NULL) {
+        return NULL;
+    }
+    if (fread(magic, 1, sizeof(magic), fp) == sizeof(magic) && !memcmp(magic, PSL_MAGIC, 8)) {
+        psl = psl_map(fp);
+    }
+    else {
+        rewind(fp);
+        psl = psl_compile(fp);
+    }
+    fclose(fp);
+    return psl;
+}
+
+int typosee_psl_save(const typosee_psl *psl, const char *path)
+{
+    FILE *fp;
+    int rc = 0;
+
+    if ((fp = fopen(path, "wb")) == NULL) {
+        return -1;
+    }
+    if (fwrite(psl->image, 1, psl->image_len, fp) != psl->image_len) {
+        rc = -1;
+    }
+    if (fclose(fp) != 0) {
+        rc = -1;
+    }
+    return rc;
+}
+
+void typosee_psl_free(typosee_psl *psl)
+{
+    if (psl) {
+        if (psl->mapped) {
+            munmap(psl->image, psl->image_len);
+        }
+        else {
+            free(psl->image);
+        }
+        free(psl);
+    }
+}
+
+static const struct psl_node *psl_child(const typosee_psl *psl, const struct psl_node *n,
+        const char *label, size_t len)
+{
+    const struct psl_node *kids = psl->node + n->child;
+    size_t lo = 0, hi = n->nchild, mid;
+    int c;
+
+    while (lo < hi) {
+        mid = (lo + hi) / 2;
+        c = psl_label_cmp(psl->pool + kids[mid].label, kids[mid].len, label, len);
+        if (c == 0) {
+            return &kids[mid];
+        }
+        if (c < 0) {
+            lo = mid + 1;
+        }
+        else {
+            hi = mid;
+        }
+    }
+    return NULL;
+}
+
+/*
+ * One pass from the right: every label matched may extend the suffix (a rule ends
+ * there, or its parent has a wildcard), an exception sets it to the parent, and
+ * the walk stops at the first label the trie doesn't know. Unlisted TLDs are public
+ * suffixes of one label, as the list's implicit "*" rule says.
+ */
+size_t typosee_psl_prefix(const typosee_psl *psl, const char *name, size_t len)
+{
+    const struct psl_node *n = psl->node, *c;
+    size_t end, start, cut, parent = 0;
+
+    if (len && name[len - 1] == '.') {
+        len--;                          /* fully qualified "example.com." */
+    }
+    cut = len;
+    for (end = len; end > 0; end = start - 1) {
+        for (start = end; start > 0 && name[start - 1] != '.'; start--)
+            ;
+        c = psl_child(psl, n, name + start, end - start);
+        if (c && (c->flags & PSL_EXCEPTION)) {
+            cut = parent;
+            break;
+        }
+        if (n == psl->node || (n->flags & PSL_WILDCARD) || (c && (c->flags & PSL_RULE))) {
+            cut = start;
+        }
+        if (c == NULL || start == 0) {
+            break;
+        }
+        n = c;
+        parent = start;
+    }
+    return cut ? cut - 1 : 0;
+}
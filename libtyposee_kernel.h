@@ -0,0 +1,300 @@
+/***************************/
+/* libtyposee_kernel.h     */
+/*                         ***********************************************************************************************************/
+/* The bit-parallel kernel of libtyposee, and the weighted kernel that takes its place when edits have costs, written once and       */
+/* compiled once per instruction set.                                                                                                */
+/*                                                                                                                                   */
+/* libtyposee.c includes this file several times, each time with KERNEL_SUFFIX (name suffix), KERNEL_LANES (labels per vector) and   */
+/* KERNEL_TARGET (the target attribute, empty for the portable build) defined, and gets the four myers_*lanes_<suffix>() variants    */
+/* (distance or search, with or without transpositions) and, but for the portable build, the two weighted_*column_<suffix>() ones    */
+/* out of it. The arithmetic is written with GCC vector extensions, so the compiler picks the instructions for each target.          */
+/*************************************************************************************************************************************/
+
+#define KERNEL_PASTE2(a, b)     a##_##b
+#define KERNEL_PASTE(a, b)      KERNEL_PASTE2(a, b)
+#define KERNEL(name)            KERNEL_PASTE(name, KERNEL_SUFFIX)
+
+typedef uint64_t KERNEL(lanes_u64) __attribute__((vector_size(KERNEL_LANES * 8)));
+typedef int64_t KERNEL(lanes_s64) __attribute__((vector_size(KERNEL_LANES * 8)));
+
+/*
+ * Myers' bit-parallel global edit distance of a keyword of m <= 64 characters (its
+ * peq[] table in the workspace) against up to KERNEL_LANES labels at once, in
+ * Hyyro's formulation. Each lane's vertical delta vectors track one label; a lane
+ * whose label has ended keeps stepping on a zero match mask, but its score is no
+ * longer updated and the step does not count towards lane utilisation.
+ *
+ * With search set it is an approximate search instead (Sellers): row 0 is all zeros,
+ * so the keyword may start anywhere in the label, and the distance is the lowest the
+ * last row reaches in any column, i.e. that of the closest substring of the label.
+ * With osa set a swap of two adjacent characters is one edit (optimal string
+ * alignment), by Hyyro's extension: the diagonal zero vector also takes the cells a
+ * transposition reaches, from this column's and the previous column's match masks.
+ * Both are constants in each of the wrappers below, so each compiles to its own loop.
+ */
+static KERNEL_TARGET inline __attribute__((always_inline)) void KERNEL(myers_body)(typosee_workspace *ws,
+        size_t m, const typosee_batch *b, const uint32_t *idx, unsigned int n, uint32_t *dist, int search, int osa)
+{
+    const uint64_t *peq = ws->peq;
+    const char *text[KERNEL_LANES];
+    uint32_t len[KERNEL_LANES], max = 0, used = 0, j;
+    KERNEL(lanes_u64) pv, mv, eq, xv, xh, ph, mh, hb, last;
+    KERNEL(lanes_s64) score, best, active, lower;
+    unsigned int l;
+
+    for (l = 0; l < KERNEL_LANES; l++) {
+        text[l] = l < n ? b->arena + b->off[idx[l]] : "";
+        len[l] = l < n ? b->len[idx[l]] : 0;
+        max = len[l] > max ? len[l] : max;
+        used += len[l];
+    }
+    pv = (KERNEL(lanes_u64)){ 0 } + (m == 64 ? ~0ull : (1ull << m) - 1);
+    mv = eq = xh = last = (KERNEL(lanes_u64)){ 0 };
+    hb = (KERNEL(lanes_u64)){ 0 } + (1ull << (m - 1));
+    active = (KERNEL(lanes_s64)){ 0 };
+    score = best = active + (int64_t)m;
+
+    for (j = 0; j < max; j++) {
+        for (l = 0; l < KERNEL_LANES; l++) {
+            eq[l] = j < len[l] ? peq[(unsigned char)text[l][j]] : 0;
+            active[l] = j < len[l] ? -1 : 0;
+        }
+        if (osa) {
+            /* xh still holds the previous column's diagonal zero vector */
+            xh = (((eq & pv) + pv) ^ pv) | eq | mv | (((~xh & eq) << 1) & last);
+            xv = xh;
+            last = eq;
+        }
+        else {
+            xv = eq | mv;
+            xh = (((eq & pv) + pv) ^ pv) | eq;
+        }
+        ph = mv | ~(xh | pv);
+        mh = pv & xh;
+        /* a true vector comparison is -1, so this is +1 / -1 / 0 per lane */
+        score += active & (((mh & hb) != 0) - ((ph & hb) != 0));
+        if (search) {
+            lower = score < best;
+            best = (lower & score) | (~lower & best);
+            ph = ph << 1;               /* no carry in: row 0 costs nothing */
+        }
+        else {
+            ph = (ph << 1) | 1;
+        }
+        mh = mh << 1;
+        pv = mh | ~(xv | ph);
+        mv = ph & xv;
+    }
+    for (l = 0; l < n; l++) {
+        dist[l] = search ? best[l] : score[l];
+    }
+    ws->stats.kernel_pairs += n;
+    ws->stats.kernel_steps += max;
+    ws->stats.lane_steps += used;
+    ws->stats.cells += m * used;
+}
+
+static KERNEL_TARGET void KERNEL(myers_lanes)(typosee_workspace *ws, size_t m, const typosee_batch *b,
+        const uint32_t *idx, unsigned int n, uint32_t *dist)
+{
+    KERNEL(myers_body)(ws, m, b, idx, n, dist, 0, 0);
+}
+
+static KERNEL_TARGET void KERNEL(myers_search_lanes)(typosee_workspace *ws, size_t m, const typosee_batch *b,
+        const uint32_t *idx, unsigned int n, uint32_t *dist)
+{
+    KERNEL(myers_body)(ws, m, b, idx, n, dist, 1, 0);
+}
+
+static KERNEL_TARGET void KERNEL(myers_osa_lanes)(typosee_workspace *ws, size_t m, const typosee_batch *b,
+        const uint32_t *idx, unsigned int n, uint32_t *dist)
+{
+    KERNEL(myers_body)(ws, m, b, idx, n, dist, 0, 1);
+}
+
+static KERNEL_TARGET void KERNEL(myers_osa_search_lanes)(typosee_workspace *ws, size_t m, const typosee_batch *b,
+        const uint32_t *idx, unsigned int n, uint32_t *dist)
+{
+    KERNEL(myers_body)(ws, m, b, idx, n, dist, 1, 1);
+}
+
+/*
+ * The weighted kernel works down the keyword: a vector holds KERNEL_ROWS rows of one
+ * column of the recurrence. The portable build has none, as two rows to a vector are
+ * no faster than the band of workspace_bounded().
+ */
+#if KERNEL_LANES > 1
+#define KERNEL_ROWS             (KERNEL_LANES * 2)
+#if KERNEL_LANES == 2
+#define KERNEL_IOTA             { 0, 1, 2, 3 }
+#elif KERNEL_LANES == 4
+#define KERNEL_IOTA             { 0, 1, 2, 3, 4, 5, 6, 7 }
+#else
+#define KERNEL_IOTA             { 0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15 }
+#endif
+
+typedef int32_t KERNEL(rows_s32) __attribute__((vector_size(KERNEL_ROWS * 4)));
+
+/* Written per row, which the compiler turns into one minimum instruction where a comparison and a blend would be two */
+static KERNEL_TARGET inline __attribute__((always_inline)) KERNEL(rows_s32) KERNEL(rows_min)(KERNEL(rows_s32) a,
+        KERNEL(rows_s32) b)
+{
+    unsigned int l;
+
+    for (l = 0; l < KERNEL_ROWS; l++) {
+        a[l] = a[l] < b[l] ? a[l] : b[l];
+    }
+    return a;
+}
+
+/* a moved s rows down, its top s rows taken from the bottom of above; s is a constant, so this is one shuffle */
+static KERNEL_TARGET inline __attribute__((always_inline)) KERNEL(rows_s32) KERNEL(rows_down)(KERNEL(rows_s32) a,
+        KERNEL(rows_s32) above, int s)
+{
+    const KERNEL(rows_s32) iota = KERNEL_IOTA;
+
+    return __builtin_shuffle(a, above, iota - s + ((iota < s) & (2 * KERNEL_ROWS)));
+}
+
+/*
+ * Lays out the keyword for the weighted kernel in ws->lanes, which the caller sized for
+ * (m + KERNEL_ROWS) / KERNEL_ROWS vectors per column: row i's cost of deleting the
+ * keyword down to it, its character and the one above, and which rows are the
+ * keyword's. The substitution profile of each label character, the column of what
+ * substituting it for every keyword character costs, is built the first time a label
+ * brings the character, so a batch pays for the characters it has and no more.
+ */
+static KERNEL_TARGET void KERNEL(weighted_keyword)(typosee_workspace *ws, const char *str1, size_t m)
+{
+    const typosee_costs *costs = ws->costs;
+    size_t nv = (m + KERNEL_ROWS) / KERNEL_ROWS, v;
+    KERNEL(rows_s32) *sums = (KERNEL(rows_s32) *)ws->lanes + 256 * nv, *kw = sums + nv, *above = kw + nv, *live = above + nv;
+    int32_t sum = 0;
+    size_t i;
+    unsigned int l;
+
+    for (v = 0; v < nv; v++) {
+        for (l = 0; l < KERNEL_ROWS; l++) {
+            i = v * KERNEL_ROWS + l;
+            sum += i >= 1 && i <= m ? costs->del[(unsigned char)str1[i - 1]] : 0;
+            sums[v][l] = sum;
+            kw[v][l] = i >= 1 && i <= m ? (unsigned char)str1[i - 1] : -1;
+            above[v][l] = i >= 2 && i <= m ? (unsigned char)str1[i - 2] : -1;
+            live[v][l] = i <= m ? -1 : 0;
+        }
+    }
+    memset(ws->profiled, 0, sizeof(ws->profiled));
+}
+
+/*
+ * The weighted recurrence of a keyword laid out by weighted_keyword() against one byte
+ * label, a column per label character. Each column is a few vector operations: the
+ * substitution and insertion terms come from the column before, and deletions, which
+ * chain down the column, are folded in by a prefix minimum over the rows. With S the
+ * running deletion cost, D[i] = min over j <= i of X[j] + S[i] - S[j], which is S[i]
+ * plus the prefix minimum of X - S, taken in log2(KERNEL_ROWS) shifted minimums and
+ * carried from one vector to the next. Cells are held at k + 1 once over k, and the
+ * label is given up once a whole column is, as in workspace_bounded(); a swap from
+ * two columns back keeps it going one column longer. The distance is k + 1 if over k.
+ */
+static KERNEL_TARGET inline __attribute__((always_inline)) void KERNEL(weighted_body)(typosee_workspace *ws,
+        size_t m, const char *str2, size_t len2, uint32_t k, uint32_t *distance, int osa)
+{
+    const typosee_costs *costs = ws->costs;
+    size_t nv = (m + KERNEL_ROWS) / KERNEL_ROWS, v, c;
+    KERNEL(rows_s32) *profile = ws->lanes, *sums = profile + 256 * nv, *kw = sums + nv, *above = kw + nv,
+        *live = above + nv, *prev2 = live + nv, *prev = prev2 + nv, *cur = prev + nv, *tmp, *p;
+    KERNEL(rows_s32) x, y, over, fill, alive, swap, zero = { 0 };
+    int32_t carry, t, last = -1;
+    uint64_t word[KERNEL_LANES], any;
+    unsigned int l;
+
+    over = zero + (int32_t)(k + 1);
+    fill = zero + INT32_MAX / 2;        /* above the top row of the prefix minimum */
+    swap = zero + costs->swap;
+    /* Column 0 deletes the keyword */
+    for (v = 0; v < nv; v++) {
+        prev[v] = (KERNEL(rows_min)(sums[v], over) & live[v]) | (over & ~live[v]);
+        prev2[v] = over;
+    }
+    for (c = 0; c < len2; c++) {
+        t = (unsigned char)str2[c];
+        p = profile + t * nv;
+        if (!ws->profiled[t]) {
+            for (v = 0; v < nv; v++) {
+                for (l = 0; l < KERNEL_ROWS; l++) {
+                    p[v][l] = kw[v][l] < 0 || kw[v][l] == t ? 0 : costs->sub[kw[v][l]][t];
+                }
+            }
+            ws->profiled[t] = 1;
+        }
+        carry = INT32_MAX / 2;
+        alive = zero;
+        for (v = 0; v < nv; v++) {
+            x = KERNEL(rows_down)(prev[v], v ? prev[v - 1] : over, 1) + p[v];
+            x = KERNEL(rows_min)(x, prev[v] + costs->ins[t]);
+            if (osa && c > 0) {
+                /* rows without the swap take k + 1, which loses the minimum */
+                y = (kw[v] == last) & (above[v] == t);
+                x = KERNEL(rows_min)(x, ((KERNEL(rows_down)(prev2[v], v ? prev2[v - 1] : over, 2) + swap) & y)
+                    | (over & ~y));
+            }
+            /* spelt out rather than looped, so that each shift is a constant shuffle */
+            y = x - sums[v];
+            y = KERNEL(rows_min)(y, KERNEL(rows_down)(y, fill, 1));
+            y = KERNEL(rows_min)(y, KERNEL(rows_down)(y, fill, 2));
+            if (KERNEL_ROWS > 4) {
+                y = KERNEL(rows_min)(y, KERNEL(rows_down)(y, fill, 4));
+            }
+            if (KERNEL_ROWS > 8) {
+                y = KERNEL(rows_min)(y, KERNEL(rows_down)(y, fill, 8));
+            }
+            y = KERNEL(rows_min)(y, zero + carry);
+            carry = y[KERNEL_ROWS - 1];
+            y = KERNEL(rows_min)(y + sums[v], over);
+            cur[v] = (y & live[v]) | (over & ~live[v]);
+            alive |= cur[v] <= (int32_t)k;
+            if (osa) {
+                alive |= prev[v] + swap <= (int32_t)k;
+            }
+        }
+        memcpy(word, &alive, sizeof(alive));
+        for (l = 0, any = 0; l < KERNEL_LANES; l++) {
+            any |= word[l];
+        }
+        if (!any) {
+            *distance = k + 1;
+            ws->stats.cells += m * (c + 1);
+            return;
+        }
+        tmp = prev2;
+        prev2 = prev;
+        prev = cur;
+        cur = tmp;
+        last = t;
+    }
+    *distance = prev[m / KERNEL_ROWS][m % KERNEL_ROWS];
+    ws->stats.cells += m * len2;
+}
+
+static KERNEL_TARGET void KERNEL(weighted_column)(typosee_workspace *ws, size_t m, const char *str2, size_t len2,
+        uint32_t k, uint32_t *distance)
+{
+    KERNEL(weighted_body)(ws, m, str2, len2, k, distance, 0);
+}
+
+static KERNEL_TARGET void KERNEL(weighted_osa_column)(typosee_workspace *ws, size_t m, const char *str2, size_t len2,
+        uint32_t k, uint32_t *distance)
+{
+    KERNEL(weighted_body)(ws, m, str2, len2, k, distance, 1);
+}
+
+#undef KERNEL_ROWS
+#undef KERNEL_IOTA
+#endif
+#undef KERNEL
+#undef KERNEL_PASTE
+#undef KERNEL_PASTE2
+#undef KERNEL_SUFFIX
+#undef KERNEL_LANES
+#undef KERNEL_TARGET
@@ -0,0 +1,41 @@
+#!/bin/sh
+#
+# Builds typosee with LABEL_HASH_MASK cut to two bits, so distinct keywords share a label hash
+# and the set has to go without its perfect hash of exact hits, and checks it prints what the
+# normal build does. The batch matcher is also verified against the reference with every label
+# hash colliding.
+#
+# Usage:  sh tests/exact_collisions.sh  (from the top of the tree; CC defaults to cc)
+
+set -e
+cd "$(dirname "$0")/.."
+tmp=$(mktemp -d)
+trap 'rm -rf "$tmp"' EXIT
+
+${CC:-cc} -O2 -pthread -o "$tmp/typosee" typosee.c libtyposee.c
+${CC:-cc} -O2 -pthread -DLABEL_HASH_MASK=0x3 -o "$tmp/typosee_collide" typosee.c libtyposee.c
+${CC:-cc} -O2 -DLABEL_HASH_MASK=0x3 -o "$tmp/typosee_bench_collide" typosee_bench.c libtyposee.c
+${CC:-cc} -O2 -o "$tmp/typosee_gen" typosee_gen.c
+
+# Six distinct keywords over four hash values must collide; paypal repeats to chain
+printf 'paypal\ngoogle\namazon\nmicrosoft\napple\nnetflix\npaypal\n' > "$tmp/keywords.txt"
+"$tmp/typosee_gen" --lines 3000 --keywords "$tmp/keywords.txt" --typos 30 --seed 11 > "$tmp/feed.csv"
+
+fail=0
+if ! "$tmp/typosee_collide" "$tmp/feed.csv" "$tmp/keywords.txt" 0 q --stats 2>&1 >/dev/null | grep -q ' 0 exact lookups'; then
+    echo "FAIL the colliding build still took exact hits from the perfect hash"
+    fail=1
+fi
+for threshold in 0 1 2; do
+    for mode in q v; do
+        "$tmp/typosee" "$tmp/feed.csv" "$tmp/keywords.txt" $threshold $mode -j 2 > "$tmp/expect"
+        if "$tmp/typosee_collide" "$tmp/feed.csv" "$tmp/keywords.txt" $threshold $mode -j 2 | cmp -s - "$tmp/expect"; then
+            echo "ok   threshold $threshold $mode"
+        else
+            echo "FAIL threshold $threshold $mode: output differs once keyword hashes collide"
+            fail=1
+        fi
+    done
+done
+"$tmp/typosee_bench_collide" --verify 100 || fail=1
+exit $fail
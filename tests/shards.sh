@@ -0,0 +1,46 @@
+#!/bin/sh
+#
+# Runs a synthetic feed serially and as 3 shards, split by FQDN hash and by byte range, in
+# verbose and debug output, and checks `typosee_merge --ordered` gives back the serial output.
+#
+# Usage:  sh tests/shards.sh            (from the top of the tree; CC defaults to cc)
+
+set -e
+cd "$(dirname "$0")/.."
+tmp=$(mktemp -d)
+trap 'rm -rf "$tmp"' EXIT
+
+${CC:-cc} -O2 -pthread -o "$tmp/typosee" typosee.c libtyposee.c
+${CC:-cc} -O2 -o "$tmp/typosee_merge" typosee_merge.c
+
+# Random labels with a keyword one edit away in about every third line
+printf 'paypal\ngoogle\namazon\nmicrosoft\n' > "$tmp/keywords.txt"
+awk 'BEGIN {
+    srand(7); n = split("paypal google amazon microsoft", kw, " "); print "a,b,c,fqdn"
+    for (i = 0; i < 5000; i++) {
+        label = ""
+        for (j = int(rand() * 8) + 3; j > 0; j--) label = label substr("abcdefghijklmnopqrstuvwxyz", int(rand() * 26) + 1, 1)
+        if (rand() < 0.3) {
+            k = kw[int(rand() * n) + 1]; p = int(rand() * length(k)) + 1
+            label = substr(k, 1, p - 1) substr("xyz01", int(rand() * 5) + 1, 1) substr(k, p + 1)
+        }
+        printf "1,2,3,%s.%s.com\n", (rand() < 0.5 ? "www." : "") label, substr("abcdefghijklmnop", int(rand() * 10) + 1, 5)
+    }
+}' > "$tmp/feed.csv"
+
+fail=0
+for mode in v d; do
+    "$tmp/typosee" "$tmp/feed.csv" "$tmp/keywords.txt" 2 $mode > "$tmp/serial"
+    for by in hash range; do
+        for i in 0 1 2; do
+            "$tmp/typosee" "$tmp/feed.csv" "$tmp/keywords.txt" 2 $mode -j 2 --shard $i/3 --shard-by $by > "$tmp/shard.$i"
+        done
+        if "$tmp/typosee_merge" --ordered "$tmp/shard.0" "$tmp/shard.1" "$tmp/shard.2" | cmp -s - "$tmp/serial"; then
+            echo "ok   $mode --shard-by $by"
+        else
+            echo "FAIL $mode --shard-by $by: merged shards differ from the serial run"
+            fail=1
+        fi
+    done
+done
+exit $fail
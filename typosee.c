@@ -23,182 +23,129 @@
 /* The unmodifed algorythm was orignally posted at http://www.martinbroadhurst.com/levenshtein-distance-in-c.html                    */
 /*                                                                                                                                   */
 /* v1 - Take a list of FQNDs from the WHOIS Subdomain database and match up each FQDN element using LDA                              */
+/* v2 - Reader/worker/writer pipeline: lines are read once and matched against every keyword by -j N worker threads                  */
+/* v3 - Regular files are mmapped and split into per-thread byte ranges at line boundaries; no reader thread                         */
+/* v4 - Keyword-block x line-chunk tiles scheduled on per-thread work-stealing deques; --stats load report                           */
+/* v5 - Output is written in serial (keyword, line) order by default through a bounded reorder buffer; --unordered                   */
+/* v6 - Workers publish output blocks through a lock-free MPSC ring; the writer drains it with large write() calls                   */
+/* v7 - --shard i/n (by FQDN hash or byte range) writes shard-tagged output for typosee_merge                                        */
+/* v8 - Matching lives in libtyposee (typosee.h): compiled keyword set, per-thread workspace, batch entry points                     */
+/* v9 - Labels are batched structure-of-arrays, sorted by length, and matched by a bit-parallel kernel a vector at a time            */
+/* v10 - The matching kernel is built for scalar, SSE4.1, AVX2 and AVX-512 and picked at run time; --isa / TYPOSEE_ISA               */
+/* v11 - --stats reports end-to-end throughput (MB/s, lines/s); typosee_gen writes synthetic feeds to measure it on                  */
+/* v12 - --stats splits wall and CPU time into parse, filter, distance and output and counts pairs, cells and matches                */
+/* v13 - Edit scripts are only built for verbose output; long keywords use a banded, early-exit distance                             */
+/* v14 - --psl: labels are cut at the public suffix from a compiled, mmappable Public Suffix List trie                               */
+/* v15 - Punycode (xn--) labels are decoded and matched on code points against UTF-8 or punycode keywords                            */
+/* v16 - --homoglyphs: labels whose confusables skeleton equals a keyword's are reported as 'h' matches                              */
+/* v17 - --substring[=fqdn]: approximate search for the keyword inside each label or the whole name, with its offset                 */
+/* v18 - --osa: transpositions cost one edit, in the bit-parallel kernel and the edit scripts                                        */
+/* v19 - --costs: a cost file weights edits (neighbouring keys, 0 for o) and the threshold becomes decimal                           */
+/* v20 - Threshold 0 takes exact hits from a minimal perfect hash of the keywords; repeated labels are matched once per chunk        */
+/* v21 - --top K / --top-labels K: the K nearest keywords per label, or rows per keyword under a shrinking bound                     */
+/* v22 - Keyword lines may carry their own threshold (paypal,1) and thresholds may be a share of the length (20%)                    */
+/* v23 - --clusters R: keywords within R edits of an earlier one skip labels ruled out by the triangle inequality                    */
 /*************************************************************************************************************************************/
 
 #include <string.h>
 #include <stdlib.h>
 #include <stdio.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <limits.h>
+#include <errno.h>
 #include <ctype.h>
 #include <string.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/resource.h>
+#include "typosee.h"
 
-typedef enum {
-    INSERTION,
-    DELETION,
-    SUBSTITUTION,
-    NONE
-} edit_type;
- 
-struct edit {
-    unsigned int score;
-    edit_type type;
-    char arg1;
-    char arg2;
-    unsigned int pos;
-    struct edit *prev;
-};
+#define LINE_MAX_LEN    2048            /* same line limit the fgets() buffers have always had */
+#define CHUNK_BYTES     (256 * 1024)    /* text handed out as one line chunk */
+#define QUEUE_SLOTS     2               /* bounded queue depth per worker thread */
+#define L2_FALLBACK     (256 * 1024)    /* when sysconf() can't tell us the L2 size */
+#define REORDER_MEM     (64 * 1024 * 1024)  /* rows parked in memory before they spill to disk */
+#define RING_SLOTS      8               /* output ring slots per worker thread */
+#define WRITE_BYTES     (1024 * 1024)   /* the writer hands stdout this much per write() */
 
-typedef struct edit edit;
-
-void print(const edit *e)
+static void *xmalloc(size_t size)
 {
-    if (e->type == INSERTION) {
-        printf("\tInsert %c", e->arg2);
-    }
-    else if (e->type == DELETION) {
-        printf("\tDelete %c", e->arg1);
-    }
-    else {
-        printf("\tSubstitute %c for %c", e->arg2, e->arg1);
+    void *p = malloc(size);
+    if (p == NULL && size) {
+        fprintf(stderr, "[ERR]: Out of memory\n");
+        exit(1);
     }
-    printf(" at %u\n", e->pos);
+    return p;
 }
- 
 
-static int min3(int a, int b, int c)
+static void *xrealloc(void *ptr, size_t size)
 {
-    if (a < b && a < c) {
-        return a;
-    }
-    if (b < a && b < c) {
-        return b;
-    }
-    return c;
-}
- 
-static unsigned int levenshtein_matrix_calculate(edit **mat, const char *str1, size_t len1,
-        const char *str2, size_t len2)
-{
-    unsigned int i, j;
-    for (j = 1; j <= len2; j++) {
-        for (i = 1; i <= len1; i++) {
-            unsigned int substitution_cost;
-            unsigned int del = 0, ins = 0, subst = 0;
-            unsigned int best;
-            if (str1[i - 1] == str2[j - 1]) {
-                substitution_cost = 0;
-            }
-            else {
-                substitution_cost = 1;
-            }
-            del = mat[i - 1][j].score + 1; /* deletion */
-            ins = mat[i][j - 1].score + 1; /* insertion */
-            subst = mat[i - 1][j - 1].score + substitution_cost; /* substitution */
-            best = min3(del, ins, subst);
-            mat[i][j].score = best;                  
-            mat[i][j].arg1 = str1[i - 1];
-            mat[i][j].arg2 = str2[j - 1];
-            mat[i][j].pos = i - 1;
-            if (best == del) {
-                mat[i][j].type = DELETION;
-                mat[i][j].prev = &mat[i - 1][j];
-            }
-            else if (best == ins) {
-                mat[i][j].type = INSERTION;
-                mat[i][j].prev = &mat[i][j - 1];
-            }
-            else {
-                if (substitution_cost > 0) {
-                    mat[i][j].type = SUBSTITUTION;
-                }
-                else {
-                    mat[i][j].type = NONE;
-                }
-                mat[i][j].prev = &mat[i - 1][j - 1];
-            }
-        }
+    void *p = realloc(ptr, size);
+    if (p == NULL && size) {
+        fprintf(stderr, "[ERR]: Out of memory\n");
+        exit(1);
     }
-    return mat[len1][len2].score;
+    return p;
 }
- 
-static edit **levenshtein_matrix_create(const char *str1, size_t len1, const char *str2,
-        size_t len2)
+
+/* Growable text buffer a worker formats its rows into before handing them to the writer */
+struct outbuf {
+    char *buf;
+    size_t len;
+    size_t cap;
+};
+
+static void ob_reserve(struct outbuf *ob, size_t need)
 {
-    unsigned int i, j;
-    edit **mat = malloc((len1 + 1) * sizeof(edit *));
-    if (mat == NULL) {
-        return NULL;
-    }
-    for (i = 0; i <= len1; i++) {
-        mat[i] = malloc((len2 + 1) * sizeof(edit));
-        if (mat[i] == NULL) {
-            for (j = 0; j < i; j++) {
-                free(mat[j]);
-            }
-            free(mat);
-            return NULL;
-        }
-    }
-    for (i = 0; i <= len1; i++) {
-        mat[i][0].score = i;
-        mat[i][0].prev = NULL;
-        mat[i][0].arg1 = 0;
-        mat[i][0].arg2 = 0;
+    if (ob->len + need <= ob->cap) {
+        return;
     }
- 
-    for (j = 0; j <= len2; j++) {
-        mat[0][j].score = j;
-        mat[0][j].prev = NULL;
-        mat[0][j].arg1 = 0;
-        mat[0][j].arg2 = 0;
+    while (ob->len + need > ob->cap) {
+        ob->cap = ob->cap ? ob->cap * 2 : 4096;
     }
-    return mat; 
+    ob->buf = xrealloc(ob->buf, ob->cap);
 }
- 
-unsigned int levenshtein_distance(const char *str1, const char *str2, edit **script)
+
+static void ob_printf(struct outbuf *ob, const char *fmt, ...)
 {
-    const size_t len1 = strlen(str1), len2 = strlen(str2);
-    unsigned int i, distance;
-    edit **mat, *head;
- 
-    /* If either string is empty, the distance is the other string's length */
-    if (len1 == 0) {
-        return len2;
+    va_list ap;
+    int n;
+
+    va_start(ap, fmt);
+    n = vsnprintf(ob->buf ? ob->buf + ob->len : NULL, ob->cap - ob->len, fmt, ap);
+    va_end(ap);
+    if (ob->len + n + 1 > ob->cap) {
+        ob_reserve(ob, n + 1);
+        va_start(ap, fmt);
+        vsnprintf(ob->buf + ob->len, ob->cap - ob->len, fmt, ap);
+        va_end(ap);
     }
-    if (len2 == 0) {
-        return len1;
+    ob->len += n;
+}
+
+void print(struct outbuf *ob, const edit *e)
+{
+    if (e->type == INSERTION) {
+        ob_printf(ob, "\tInsert %c", e->arg2);
     }
-    /* Initialise the matrix */
-    mat = levenshtein_matrix_create(str1, len1, str2, len2);
-    if (!mat) {
-        *script = NULL;
-        return 0;
+    else if (e->type == DELETION) {
+        ob_printf(ob, "\tDelete %c", e->arg1);
     }
-    /* Main algorithm */
-    distance = levenshtein_matrix_calculate(mat, str1, len1, str2, len2);
-    /* Read back the edit script */
-    *script = malloc(distance * sizeof(edit));
-    if (*script) {
-        i = distance - 1;
-        for (head = &mat[len1][len2];
-                head->prev != NULL;
-                head = head->prev) {
-            if (head->type != NONE) {
-                memcpy(*script + i, head, sizeof(edit));
-                i--;
-            }
-        }
+    else if (e->type == TRANSPOSITION) {
+        ob_printf(ob, "\tSwap %c%c", e->arg1, e->arg2);
     }
     else {
-        distance = 0;
-    }
-    /* Clean up */
-    for (i = 0; i <= len1; i++) {
-        free(mat[i]);
+        ob_printf(ob, "\tSubstitute %c for %c", e->arg2, e->arg1);
     }
-    free(mat);
- 
-    return distance;
+    ob_printf(ob, " at %u\n", e->pos);
 }
+ 
 
 int count_periods(char *str)
 {
@@ -230,6 +177,9 @@ void strip(char *str)
 {
 	int i;
 
+	if(!*str)
+		return;
+
 	if(str[strlen(str)-1] == '\n' || str[strlen(str)-1] == '\r')
 		str[strlen(str)-1] = 0x0;
 		
@@ -262,142 +212,1901 @@ void strip_subline(char *str)
 	strcpy(str, buf);
 }
 
-int main(int argc, char **argv)
+
+/* A threshold as written: edits (tenths of one with edit costs), or with a '%' a share of the keyword's length */
+struct limit {
+    double value;
+    int ratio;
+};
+
+static int parse_limit(const char *text, struct limit *l)
 {
-    FILE *fp, *kfp;
-    edit *script;
-    unsigned int distance, threshold;
-    unsigned int i, x, lineNum = 0, token_cnt, num_p, debug=0;
-    char fileName[1024], keyWord[2048], lineBuf[2048], copyOfLine[2048], verbose=0, fqdn_word[2048], keyLineBuf[2048];
-    char *token;
-    const char period[2] = ".\0";
-    
-    if(argc < 4)
-    	{
-	printf("\ntyposee by Ed@whoisxmlapi.com.\n\n\t");
-	printf("args: subdomain_filename keyword_filename Threshhold# [v:q]  where 'q'=quiet, 'v'=verbose\n\n");
-	return 0;
-	}
-	
-    strcpy(fileName, argv[1]);
-    strcpy(keyWord, argv[2]);
-    
-    threshold = atoi(argv[3]);
-    
-    if(threshold < 1 || threshold > 100)
-    	{
-    	printf("[ERR] Invalid threshold number. Must be between 0 and 100.\n");
-    	return 0;
-    	}
-    
-    if(argv[4][0] == 'v')
-    	verbose = 1;
-    if(argv[4][0] == 'd')
-    	debug = 1;
-    	
-    if( (fp = fopen(fileName, "rt")) == NULL)
-    	{
-    	printf("[ERR]: Unable to open %s\n", fileName);
-    	return 0;
-    	}
-    	
-    if( (kfp = fopen(keyWord, "rt")) == NULL)
-    	{
-    	printf("[ERR]: Unable to open %s\n", keyWord);
-    	return 0;
-    	}
-    	
-    printf("distance,keyword,fqdn-element,full-fqdn\n");
-    	
-    while( fgets(keyLineBuf, 2048, kfp)!= NULL )
-    {
-    	strip(keyLineBuf);
-    	
-    	strcpy(keyWord, keyLineBuf);
-    	
-    	if(debug)
-    		printf("[DEBUG] ReadLine [%s]\n", keyLineBuf);
-    		
-    	token_cnt = 0;
-    
-       while( fgets(lineBuf, 2048, fp) != NULL)
-    	{
- 	   if(!lineNum++)
- 	   	{
- 	   	if(debug)
- 	   		printf("[DEBUG]: lineNum = %d\n", lineNum);		
- 	   	continue;
- 	   	}
- 
- 	   strip_subline(lineBuf);
- 	
- 	   token_cnt = num_p = 0;
- 	
- 	   num_p = count_periods(lineBuf);
- 	
- 	   strcpy(copyOfLine, lineBuf);
- 	   
- 	   if(debug)
- 	   	printf("%s, %d for [%s]\n", keyWord, lineNum, lineBuf);
- 
- 	   if( (token = strtok(lineBuf, period)) != NULL)
- 		{
-		memset(&script, sizeof(script), 0x0);
- 
-		distance = levenshtein_distance(keyWord, token, &script);
-	
-		if(distance <= threshold)
-			{
-			printf("%d,%s,%s,%s\n", distance, keyWord, token, copyOfLine);
-			
-			if(debug)
-				printf("K: [%s], H: [%s] in [%s]\n\tDistance is %d:\n", keyWord, token, copyOfLine, distance);
-
-			if(verbose)
-		   		for (i = 0; i < distance; i++) 
-		     			print(&script[i]);
-		     	}
-		     		
-		token_cnt++;
-		
-		if(token_cnt == num_p)			/* don't process domain */
-			continue;
- 	
-		while(token != NULL)
-			{	
-			if(token_cnt++ == num_p)
-				break;
-		
-			if( (token = strtok(NULL, period)) == NULL)
-				break;
-			
-			memset(&script, sizeof(script), 0x0);
- 
-			distance = levenshtein_distance(keyWord, token, &script);
-			
-			if(distance <= threshold)
-				{
-				printf("%d,%s,%s,%s\n", distance, keyWord, token, copyOfLine);
-				
-				if(debug)
-					printf("K: [%s], H: [%s] in [%s]\n\tDistance is %d:\n", keyWord, token, copyOfLine, distance);
-
-				if(verbose)
-		   			for (i = 0; i < distance; i++) 
-		     				print(&script[i]);
-		     		}
-		     	}
-		}
-    	}
-    	rewind(fp);
+    char *end;
+
+    l->value = strtod(text, &end);
+    l->ratio = end != text && *end == '%';
+    return end != text && !end[l->ratio] && l->value >= 0 && l->value <= 100 ? 0 : -1;
+}
+
+/* The limit in the matcher's units for a keyword of chars characters; ratios and whole edits round down, costs to the tenth */
+static unsigned int limit_units(const struct limit *l, size_t chars, int weighted)
+{
+    double edits = l->ratio ? l->value * chars / 100 : l->value;
+
+    if (weighted && !l->ratio) {
+        return (unsigned int)(edits * TYPOSEE_COST_UNIT + 0.5);
+    }
+    return (unsigned int)(edits * (weighted ? TYPOSEE_COST_UNIT : 1) + 1e-9);
+}
+
+/* Characters rather than bytes, so a ratio means the same for a UTF-8 keyword */
+static size_t utf8_chars(const char *s)
+{
+    size_t n = 0;
+
+    for (; *s; s++) {
+        n += ((unsigned char)*s & 0xc0) != 0x80;
+    }
+    return n;
+}
+
+/*
+ * Keywords are read and compiled once up front so every worker can match its lines
+ * against the whole list. A line may end in ",threshold" to give its keyword its own;
+ * when one does, or the threshold is a ratio, every keyword gets its bound worked out
+ * here, in *thresholds, and *threshold becomes the highest of them.
+ */
+static typosee_set *load_keywords(FILE *kfp, const struct limit *global, int weighted,
+        unsigned int **thresholds, unsigned int *threshold)
+{
+    char keyLineBuf[LINE_MAX_LEN];
+    char **words = NULL, *comma;
+    struct limit *limits = NULL;
+    unsigned int i, count = 0, cap = 0, own = 0;
+    typosee_set *set;
+
+    while (fgets(keyLineBuf, LINE_MAX_LEN, kfp) != NULL) {
+        strip(keyLineBuf);
+        if (count == cap) {
+            cap = cap ? cap * 2 : 64;
+            words = xrealloc(words, cap * sizeof(char *));
+            limits = xrealloc(limits, cap * sizeof(struct limit));
+        }
+        limits[count] = *global;
+        if ((comma = strrchr(keyLineBuf, ',')) != NULL && (isdigit((unsigned char)comma[1]) || comma[1] == '.')) {
+            if (parse_limit(comma + 1, &limits[count]) < 0) {
+                printf("[ERR] Invalid threshold for keyword %s. Must be between 0 and 100, or 0%% and 100%%.\n", keyLineBuf);
+                exit(0);
+            }
+            *comma = 0x0;
+            own = 1;
+        }
+        words[count] = xmalloc(strlen(keyLineBuf) + 1);
+        strcpy(words[count++], keyLineBuf);
+    }
+    if ((set = typosee_set_compile((const char *const *)words, NULL, count)) == NULL) {
+        fprintf(stderr, "[ERR]: Out of memory\n");
+        exit(1);
+    }
+    if (own || global->ratio) {
+        *thresholds = xmalloc((count ? count : 1) * sizeof(unsigned int));
+        for (i = 0, *threshold = 0; i < count; i++) {
+            (*thresholds)[i] = limit_units(&limits[i], utf8_chars(words[i]), weighted);
+            *threshold = (*thresholds)[i] > *threshold ? (*thresholds)[i] : *threshold;
+            if (typosee_set_threshold(set, i, (*thresholds)[i]) < 0) {
+                fprintf(stderr, "[ERR]: Out of memory\n");
+                exit(1);
+            }
+        }
+    }
+    for (i = 0; i < count; i++) {
+        free(words[i]);
+    }
+    free(words);
+    free(limits);
+    return set;
+}
+
+/*
+ * Number of keywords per tile. Half of L2 is left to the keyword block so it stays
+ * resident while a worker streams the labels of one chunk past it.
+ */
+static unsigned int keyword_block_size(const typosee_set *set)
+{
+    long l2 = sysconf(_SC_LEVEL2_CACHE_SIZE);
+    unsigned int count = typosee_set_count(set);
+    size_t per_kw, n;
+
+    if (l2 <= 0) {
+        l2 = L2_FALLBACK;
+    }
+    if (count == 0) {
+        return 1;
+    }
+    per_kw = typosee_set_footprint(set) / count + 1;
+    n = (size_t)l2 / 2 / per_kw;
+    if (n < 1) {
+        n = 1;
+    }
+    return n < count ? n : count;
+}
+
+/* A run of subdomain lines, NUL-terminated back to back in text[], and the labels cut from them */
+struct chunk {
+    unsigned long long pos;             /* input bytes covered, header included; orders the output */
+    unsigned long long end;
+    unsigned long long first_line;      /* lineNum of line_off[0], for debug traces */
+    unsigned int nlines;
+    unsigned int lines_cap;
+    unsigned int kept;                  /* lines that belong to this shard */
+    unsigned int *line_off;
+    unsigned int *line_rel;             /* where each line starts in the input, relative to pos */
+    char *text;
+    size_t text_len;
+    size_t text_cap;
+    typosee_batch labels;               /* line[] is the index into line_off[] */
+    struct tile *tiles;                 /* one per keyword block */
+    atomic_uint tiles_left;
+};
+
+/* Unit of scheduling: one keyword block matched against every label of one chunk */
+struct tile {
+    struct chunk *c;
+    unsigned int kw_first;
+    unsigned int kw_count;
+};
+
+static struct chunk *chunk_new(void)
+{
+    struct chunk *c = xmalloc(sizeof(*c));
+
+    memset(c, 0, sizeof(*c));
+    return c;
+}
+
+static void chunk_free(struct chunk *c)
+{
+    free(c->line_off);
+    free(c->line_rel);
+    free(c->text);
+    typosee_batch_free(&c->labels);
+    free(c->tiles);
+    free(c);
+}
+
+/* Room for one more line of up to LINE_MAX_LEN bytes, NUL included */
+static char *chunk_line_buf(struct chunk *c)
+{
+    if (c->text_len + LINE_MAX_LEN > c->text_cap) {
+        c->text_cap = c->text_cap * 2 > c->text_len + LINE_MAX_LEN ? c->text_cap * 2 : c->text_len + LINE_MAX_LEN;
+        c->text = xrealloc(c->text, c->text_cap);
+    }
+    return c->text + c->text_len;
+}
+
+static void chunk_commit_line(struct chunk *c, size_t len, unsigned int rel)
+{
+    if (c->nlines == c->lines_cap) {
+        c->lines_cap = c->lines_cap ? c->lines_cap * 2 : 1024;
+        c->line_off = xrealloc(c->line_off, c->lines_cap * sizeof(unsigned int));
+        c->line_rel = xrealloc(c->line_rel, c->lines_cap * sizeof(unsigned int));
+    }
+    c->line_rel[c->nlines] = rel;
+    c->line_off[c->nlines++] = c->text_len;
+    c->text[c->text_len + len] = 0x0;
+    c->text_len += len + 1;
+}
+
+/* Bounded blocking FIFO connecting two pipeline stages */
+struct queue {
+    void **slots;
+    unsigned int size;
+    unsigned int head;
+    unsigned int count;
+    int closed;
+    pthread_mutex_t lock;
+    pthread_cond_t not_full;
+};
+
+static void queue_init(struct queue *q, unsigned int size)
+{
+    q->slots = xmalloc(size * sizeof(void *));
+    q->size = size;
+    q->head = q->count = 0;
+    q->closed = 0;
+    pthread_mutex_init(&q->lock, NULL);
+    pthread_cond_init(&q->not_full, NULL);
+}
+
+static void queue_destroy(struct queue *q)
+{
+    pthread_mutex_destroy(&q->lock);
+    pthread_cond_destroy(&q->not_full);
+    free(q->slots);
+}
+
+static void queue_push(struct queue *q, void *item)
+{
+    pthread_mutex_lock(&q->lock);
+    while (q->count == q->size) {
+        pthread_cond_wait(&q->not_full, &q->lock);
+    }
+    q->slots[(q->head + q->count++) % q->size] = item;
+    pthread_mutex_unlock(&q->lock);
+}
+
+/* Non-blocking pop: 1 with *item set, 0 if empty for now, -1 once closed and drained */
+static int queue_trypop(struct queue *q, void **item)
+{
+    int ret;
+
+    pthread_mutex_lock(&q->lock);
+    if (q->count) {
+        *item = q->slots[q->head];
+        q->head = (q->head + 1) % q->size;
+        q->count--;
+        pthread_cond_signal(&q->not_full);
+        ret = 1;
+    }
+    else {
+        ret = q->closed ? -1 : 0;
+    }
+    pthread_mutex_unlock(&q->lock);
+    return ret;
+}
+
+static void queue_close(struct queue *q)
+{
+    pthread_mutex_lock(&q->lock);
+    q->closed = 1;
+    pthread_mutex_unlock(&q->lock);
+}
+
+/*
+ * Chase-Lev work-stealing deque of tiles. The owning worker pushes and pops at the
+ * bottom, other workers steal from the top. Capacity is fixed: a worker only pushes
+ * the tiles of one chunk, and only once its deque has run dry.
+ */
+struct deque {
+    atomic_long top;
+    atomic_long bottom;
+    long mask;
+    _Atomic(struct tile *) *buf;
+};
+
+static void deque_init(struct deque *d, unsigned int min_size)
+{
+    long size = 1;
+
+    while (size < (long)min_size) {
+        size <<= 1;
+    }
+    d->buf = xmalloc(size * sizeof(*d->buf));
+    d->mask = size - 1;
+    atomic_init(&d->top, 0);
+    atomic_init(&d->bottom, 0);
+}
+
+static void deque_push(struct deque *d, struct tile *t)
+{
+    long b = atomic_load_explicit(&d->bottom, memory_order_relaxed);
+
+    atomic_store_explicit(&d->buf[b & d->mask], t, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+    atomic_store_explicit(&d->bottom, b + 1, memory_order_relaxed);
+}
+
+static struct tile *deque_pop(struct deque *d)
+{
+    long b = atomic_load_explicit(&d->bottom, memory_order_relaxed) - 1;
+    long t;
+    struct tile *x = NULL;
+
+    atomic_store_explicit(&d->bottom, b, memory_order_relaxed);
+    atomic_thread_fence(memory_order_seq_cst);
+    t = atomic_load_explicit(&d->top, memory_order_relaxed);
+    if (t <= b) {
+        x = atomic_load_explicit(&d->buf[b & d->mask], memory_order_relaxed);
+        if (t == b) {
+            /* last tile: race any thief for it */
+            if (!atomic_compare_exchange_strong_explicit(&d->top, &t, t + 1,
+                    memory_order_seq_cst, memory_order_relaxed)) {
+                x = NULL;
+            }
+            atomic_store_explicit(&d->bottom, b + 1, memory_order_relaxed);
+        }
+    }
+    else {
+        atomic_store_explicit(&d->bottom, b + 1, memory_order_relaxed);
+    }
+    return x;
+}
+
+static struct tile *deque_steal(struct deque *d)
+{
+    long t = atomic_load_explicit(&d->top, memory_order_acquire);
+    long b;
+    struct tile *x;
+
+    atomic_thread_fence(memory_order_seq_cst);
+    b = atomic_load_explicit(&d->bottom, memory_order_acquire);
+    if (t >= b) {
+        return NULL;
     }
+    x = atomic_load_explicit(&d->buf[t & d->mask], memory_order_relaxed);
+    if (!atomic_compare_exchange_strong_explicit(&d->top, &t, t + 1,
+            memory_order_seq_cst, memory_order_relaxed)) {
+        return NULL;
+    }
+    return x;
+}
+
+struct block;
+
+/*
+ * Lock-free multi-producer, single-consumer ring of finished output blocks (Vyukov's
+ * bounded queue with a single consumer). Each slot's sequence number says whether it
+ * is free for the producer claiming that position or full for the writer. Workers
+ * that find the ring full, and the writer when it finds it empty, back off instead
+ * of blocking on a lock; each such wait counts as one stall.
+ */
+struct ring {
+    struct ring_slot {
+        atomic_size_t seq;
+        struct block *b;
+    } *slots;
+    size_t mask;
+    atomic_size_t tail;                 /* next position producers claim */
+    size_t head;                        /* next position the writer reads; writer only */
+    atomic_uint producers;              /* workers that may still publish */
+    atomic_ulong push_stalls;
+    unsigned long pop_stalls;
+    size_t depth_peak;
+    unsigned long long depth_sum;
+    unsigned long pops;
+};
+
+static void ring_init(struct ring *r, unsigned int min_slots, unsigned int producers)
+{
+    size_t size = 1, i;
+
+    while (size < min_slots) {
+        size <<= 1;
+    }
+    r->slots = xmalloc(size * sizeof(struct ring_slot));
+    for (i = 0; i < size; i++) {
+        atomic_init(&r->slots[i].seq, i);
+    }
+    r->mask = size - 1;
+    atomic_init(&r->tail, 0);
+    r->head = 0;
+    atomic_init(&r->producers, producers);
+    atomic_init(&r->push_stalls, 0);
+    r->pop_stalls = 0;
+    r->depth_peak = 0;
+    r->depth_sum = 0;
+    r->pops = 0;
+}
+
+static void backoff(unsigned int *spins)
+{
+    struct timespec ts = { 0, 50000 };
+
+    if (++*spins < 64) {
+        sched_yield();
+    }
+    else {
+        nanosleep(&ts, NULL);
+    }
+}
+
+static void ring_push(struct ring *r, struct block *b)
+{
+    size_t pos = atomic_load_explicit(&r->tail, memory_order_relaxed), seq;
+    struct ring_slot *s;
+    unsigned int spins = 0;
+    intptr_t diff;
+
+    for (;;) {
+        s = &r->slots[pos & r->mask];
+        seq = atomic_load_explicit(&s->seq, memory_order_acquire);
+        diff = (intptr_t)seq - (intptr_t)pos;
+        if (diff == 0) {
+            if (atomic_compare_exchange_weak_explicit(&r->tail, &pos, pos + 1,
+                    memory_order_relaxed, memory_order_relaxed)) {
+                break;
+            }
+        }
+        else if (diff < 0) {
+            /* ring full: the writer is behind */
+            if (spins == 0) {
+                atomic_fetch_add_explicit(&r->push_stalls, 1, memory_order_relaxed);
+            }
+            backoff(&spins);
+            pos = atomic_load_explicit(&r->tail, memory_order_relaxed);
+        }
+        else {
+            pos = atomic_load_explicit(&r->tail, memory_order_relaxed);
+        }
+    }
+    s->b = b;
+    atomic_store_explicit(&s->seq, pos + 1, memory_order_release);
+}
+
+/* Called by each producer once it has published its last block */
+static void ring_producer_done(struct ring *r)
+{
+    atomic_fetch_sub_explicit(&r->producers, 1, memory_order_release);
+}
 
-    free(script);
+/* Writer side: waits for the next block, or returns NULL once every producer is done and the ring is drained */
+static struct block *ring_pop(struct ring *r)
+{
+    struct ring_slot *s;
+    struct block *b;
+    unsigned int spins = 0, producers;
+    size_t depth;
+
+    for (;;) {
+        producers = atomic_load_explicit(&r->producers, memory_order_acquire);
+        s = &r->slots[r->head & r->mask];
+        if (atomic_load_explicit(&s->seq, memory_order_acquire) == r->head + 1) {
+            break;
+        }
+        if (producers == 0) {
+            return NULL;
+        }
+        if (spins == 0) {
+            r->pop_stalls++;
+        }
+        backoff(&spins);
+    }
+    depth = atomic_load_explicit(&r->tail, memory_order_relaxed) - r->head;
+    if (depth > r->depth_peak) {
+        r->depth_peak = depth;
+    }
+    r->depth_sum += depth;
+    r->pops++;
+    b = s->b;
+    atomic_store_explicit(&s->seq, r->head + r->mask + 1, memory_order_release);
+    r->head++;
+    return b;
+}
+
+struct pipeline;
+
+/* A --top-labels row kept for a keyword, ranked by distance and then by where it is in the input */
+struct pick {
+    unsigned int distance;
+    unsigned long long pos;
+    unsigned int label;
+    char *row;                          /* the row as printed, verbose lines included */
+    size_t len;
+};
+
+/* A keyword's closest rows so far: a max-heap of --top-labels picks, and its worst distance once full */
+struct nearest {
+    pthread_mutex_t lock;
+    struct pick *heap;
+    unsigned int n;
+    atomic_uint bound;
+};
+
+/* One matching thread: its tile deque, the part of an mmapped file it still owns, and its load counters */
+struct worker {
+    struct pipeline *pl;
+    unsigned int id;
+    pthread_t thread;
+    struct deque tiles;
+    typosee_workspace *ws;
+    unsigned int *bounds;               /* --top-labels: each keyword's bound, as of the tile being matched */
+    pthread_mutex_t range_lock;
+    size_t pos;
+    size_t end;
+    unsigned long long lines;           /* this worker's own lineNum */
+    unsigned long long busy_ns;
+    unsigned long long wall_ns;
+    typosee_time parse;                 /* cutting chunks and tokenising them */
+    unsigned long long labels;
+    unsigned long chunks;
+    unsigned long tiles_run;
+    unsigned long tiles_stolen;
+    unsigned long ranges_stolen;
+};
+
+/* Everything the reader, worker and writer stages share */
+struct pipeline {
+    FILE *fp;
+    const char *map;                    /* whole subdomain file when it could be mmapped */
+    size_t map_len;
+    typosee_set *keywords;
+    typosee_psl *psl;                   /* --psl: labels come from in front of the public suffix */
+    typosee_costs *costs;               /* --costs: weighted edits; the threshold and distances are in tenths */
+    unsigned int *thresholds;           /* per keyword, when the keyword file or a ratio sets them; NULL otherwise */
+    unsigned int nkeywords;
+    unsigned int kw_block;              /* keywords per tile */
+    unsigned int nblocks;
+    unsigned int threshold;
+    char verbose;
+    char debug;
+    char stats;
+    char unordered;                     /* write blocks as they finish instead of in serial order */
+    char homoglyphs;                    /* --homoglyphs: also report skeleton collisions, as distance "h" */
+    char substring;                     /* --substring: 1 to search each label, 2 the whole FQDN */
+    char osa;                           /* --osa: a swap of adjacent characters is one edit */
+    unsigned int top;                   /* --top: the closest keywords per label; 0 for all within the threshold */
+    unsigned int top_labels;            /* --top-labels: the closest labels per keyword, over the whole input */
+    struct nearest *nearest;            /* --top-labels: one per keyword */
+    char clusters;                      /* --clusters: keywords near an earlier one are pruned through it */
+    unsigned int radius;                /* edits a keyword can be from its anchor */
+    int anchored;                       /* keywords that got an anchor */
+    unsigned long long lineNum;         /* lines read by the reader stage, header included */
+    unsigned long long lines;           /* subdomain lines, once the run is over */
+    unsigned int shard;                 /* --shard shard/shards; shards == 0 when not sharding */
+    unsigned int shards;
+    char shard_by_range;
+    unsigned long long input_start;     /* byte range of the input this run covers */
+    unsigned long long input_end;
+    atomic_ullong shard_lines;
+    struct worker *workers;
+    unsigned int nworkers;
+    atomic_uint outstanding;            /* tiles queued or running, plus chunks being cut */
+    atomic_int input_done;
+    struct queue chunks;                /* reader -> workers */
+    struct ring blocks;                 /* workers -> writer */
+    struct outbuf out;                  /* writer's pending stdout bytes */
+    unsigned long long bytes_written;
+    typosee_time write;                 /* write() calls, and the writer thread's CPU time */
+    unsigned long long bytes_read;      /* input bytes, header included */
+    unsigned long long wall_ns;         /* from the first thread started to the last one joined */
+    size_t reorder_peak;                /* most bytes the reorder buffer held in memory */
+    unsigned long long spilled;         /* bytes it had to park on disk */
+};
+
+static unsigned long long now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (unsigned long long)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+/* CPU time of the calling thread */
+static unsigned long long cpu_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return (unsigned long long)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static void *reader_stage(void *arg)
+{
+    struct pipeline *pl = arg;
+    struct chunk *c = NULL;
+    unsigned long long bytes = 0;
+    char *line;
+
+    for (;;) {
+        if (c == NULL) {
+            c = chunk_new();
+            c->pos = bytes;
+        }
+        line = chunk_line_buf(c);
+        if (fgets(line, LINE_MAX_LEN, pl->fp) == NULL) {
+            break;
+        }
+        bytes += strlen(line);
+        if (!pl->lineNum++) {
+            continue;
+        }
+        if (c->nlines == 0) {
+            c->first_line = pl->lineNum;
+        }
+        chunk_commit_line(c, strlen(line), bytes - strlen(line) - c->pos);
+        if (c->text_len >= CHUNK_BYTES) {
+            c->end = bytes;
+            queue_push(&pl->chunks, c);
+            c = NULL;
+        }
+    }
+    c->end = bytes;
+    pl->bytes_read = bytes;
+    if (c->nlines) {
+        queue_push(&pl->chunks, c);
+    }
+    else {
+        chunk_free(c);
+    }
+    queue_close(&pl->chunks);
+    return NULL;
+}
+
+/* Moves a byte offset forward to the start of the next line */
+static size_t align_to_line(const char *map, size_t len, size_t off)
+{
+    const char *nl;
+
+    if (off == 0 || off >= len || map[off - 1] == '\n') {
+        return off < len ? off : len;
+    }
+    nl = memchr(map + off, '\n', len - off);
+    return nl ? (size_t)(nl - map) + 1 : len;
+}
+
+/* Takes the next CHUNK_BYTES worth of whole lines from the worker's own range */
+static int claim_span(struct worker *w, size_t *start, size_t *stop)
+{
+    struct pipeline *pl = w->pl;
+    int ok = 0;
+
+    pthread_mutex_lock(&w->range_lock);
+    if (w->pos < w->end) {
+        *start = w->pos;
+        *stop = w->end - w->pos > CHUNK_BYTES ? align_to_line(pl->map, pl->map_len, w->pos + CHUNK_BYTES) : w->end;
+        if (*stop > w->end) {
+            *stop = w->end;
+        }
+        w->pos = *stop;
+        ok = 1;
+    }
+    pthread_mutex_unlock(&w->range_lock);
+    return ok;
+}
+
+/* Splits off the back half of the first other range that is still worth sharing */
+static int steal_range(struct worker *w)
+{
+    struct pipeline *pl = w->pl;
+    struct worker *v;
+    size_t mid = 0, end = 0;
+    unsigned int i;
+
+    for (i = 1; i < pl->nworkers && mid == end; i++) {
+        v = &pl->workers[(w->id + i) % pl->nworkers];
+        pthread_mutex_lock(&v->range_lock);
+        if (v->end - v->pos > 2 * CHUNK_BYTES) {
+            mid = align_to_line(pl->map, pl->map_len, v->pos + (v->end - v->pos) / 2);
+            if (mid < v->end) {
+                end = v->end;
+                v->end = mid;
+            }
+            else {
+                mid = end = 0;
+            }
+        }
+        pthread_mutex_unlock(&v->range_lock);
+    }
+    if (mid == end) {
+        return 0;
+    }
+    pthread_mutex_lock(&w->range_lock);
+    w->pos = mid;
+    w->end = end;
+    pthread_mutex_unlock(&w->range_lock);
+    return 1;
+}
+
+/* Debug: the lineNum a reader stage would have had at `pos`, counting lines as fgets() cuts them */
+static unsigned long long line_number(const char *map, size_t pos)
+{
+    const char *p = map, *end = map + pos, *nl;
+    unsigned long long n = 1;
+    size_t len;
+
+    for (; p < end; p += len, n++) {
+        len = (size_t)(end - p) < LINE_MAX_LEN - 1 ? (size_t)(end - p) : LINE_MAX_LEN - 1;
+        if ((nl = memchr(p, '\n', len)) != NULL) {
+            len = nl - p + 1;
+        }
+    }
+    return n;
+}
+
+/*
+ * Copies the lines of [start, stop) out of the mapping. Lines are cut exactly as
+ * fgets() would cut them so both input paths see the same input, and only the span
+ * starting at offset 0 skips the header.
+ */
+static struct chunk *scan_span(struct worker *w, size_t start, size_t stop)
+{
+    const char *p = w->pl->map + start, *end = w->pl->map + stop, *nl;
+    struct chunk *c = chunk_new();
+    size_t len;
+
+    c->pos = start;
+    c->end = stop;
+    if (w->pl->debug) {
+        c->first_line = line_number(w->pl->map, start) + (start == 0);
+    }
+    while (p < end) {
+        len = (size_t)(end - p) < LINE_MAX_LEN - 1 ? (size_t)(end - p) : LINE_MAX_LEN - 1;
+        if ((nl = memchr(p, '\n', len)) != NULL) {
+            len = nl - p + 1;
+        }
+        w->lines++;
+        if (p == w->pl->map) {
+            p += len;
+            continue;
+        }
+        memcpy(chunk_line_buf(c), p, len);
+        chunk_commit_line(c, len, p - (w->pl->map + start));
+        p += len;
+    }
+    return c;
+}
+
+/* Next chunk from whichever input the pipeline is running on, or NULL if none is ready */
+static struct chunk *next_chunk(struct worker *w)
+{
+    struct pipeline *pl = w->pl;
+    size_t start, stop;
+    void *c;
+
+    if (pl->map == NULL) {
+        switch (queue_trypop(&pl->chunks, &c)) {
+        case 1:
+            return c;
+        case -1:
+            atomic_store(&pl->input_done, 1);
+            break;
+        }
+        return NULL;
+    }
+    if (claim_span(w, &start, &stop)) {
+        return scan_span(w, start, stop);
+    }
+    if (steal_range(w) && claim_span(w, &start, &stop)) {
+        w->ranges_stolen++;
+        return scan_span(w, start, stop);
+    }
+    return NULL;
+}
+
+static int input_exhausted(struct pipeline *pl)
+{
+    unsigned int i;
+    int empty = 1;
+
+    if (pl->map == NULL) {
+        return atomic_load(&pl->input_done);
+    }
+    for (i = 0; i < pl->nworkers && empty; i++) {
+        pthread_mutex_lock(&pl->workers[i].range_lock);
+        empty = pl->workers[i].pos >= pl->workers[i].end;
+        pthread_mutex_unlock(&pl->workers[i].range_lock);
+    }
+    return empty;
+}
+
+/* FNV-1a over the FQDN as it is matched, so every node agrees on which shard owns a line */
+static uint64_t fqdn_hash(const char *s)
+{
+    uint64_t h = 0xcbf29ce484222325ull;
+
+    for (; *s; s++) {
+        h = (h ^ (unsigned char)*s) * 0x100000001b3ull;
+    }
+    return h;
+}
+
+/* Cuts the labels out of every line once; all tiles of the chunk share them */
+static void parse_chunk(const struct pipeline *pl, struct chunk *c)
+{
+    const char period[2] = ".\0";
+    unsigned int n, b, num_p, token_cnt;
+    char copy[LINE_MAX_LEN], *line, *token, *save;
+
+    for (n = 0; n < c->nlines; n++) {
+        line = c->text + c->line_off[n];
+
+        strip_subline(line);
+        if (pl->shards && !pl->shard_by_range && fqdn_hash(line) % pl->shards != pl->shard) {
+            continue;
+        }
+        c->kept++;
+        strcpy(copy, line);
+        if (pl->psl) {
+            copy[typosee_psl_prefix(pl->psl, copy, strlen(copy))] = 0x0;
+            num_p = UINT_MAX;
+        }
+        else {
+            num_p = count_periods(line);
+        }
+        if (pl->substring == 2) {           /* the name in front of the TLD or public suffix, dots and all */
+            if (num_p != UINT_MAX && num_p && (token = strrchr(copy, '.')) != NULL) {
+                *token = 0x0;
+            }
+            if (*copy && typosee_batch_add(&c->labels, copy, strlen(copy), n) < 0) {
+                fprintf(stderr, "[ERR]: Out of memory\n");
+                exit(1);
+            }
+            continue;
+        }
+
+        token_cnt = 0;
+        for (token = strtok_r(copy, period, &save); token != NULL; token = strtok_r(NULL, period, &save)) {
+            if (typosee_batch_add(&c->labels, token, strlen(token), n) < 0) {
+                fprintf(stderr, "[ERR]: Out of memory\n");
+                exit(1);
+            }
+            if (++token_cnt >= num_p) {     /* don't process domain */
+                break;
+            }
+        }
+    }
+    if (typosee_batch_seal(&c->labels) < 0) {
+        fprintf(stderr, "[ERR]: Out of memory\n");
+        exit(1);
+    }
+
+    c->tiles = xmalloc(pl->nblocks * sizeof(struct tile));
+    for (b = 0; b < pl->nblocks; b++) {
+        c->tiles[b].c = c;
+        c->tiles[b].kw_first = b * pl->kw_block;
+        c->tiles[b].kw_count = pl->nkeywords - c->tiles[b].kw_first < pl->kw_block
+            ? pl->nkeywords - c->tiles[b].kw_first : pl->kw_block;
+    }
+    atomic_init(&c->tiles_left, pl->nblocks);
+}
+
+/* Rows of one tile, with where each keyword's rows end so the writer can restore serial order */
+struct block {
+    unsigned long long pos;             /* the chunk's first input byte doubles as its sequence number */
+    unsigned long long end;
+    unsigned int kw_first;
+    unsigned int kw_count;
+    size_t *slice_end;
+    struct outbuf ob;
+};
+
+/* Where typosee_match_block() results land; slice_end[] is filled in as the keywords go by */
+struct tile_out {
+    const struct pipeline *pl;
+    const struct chunk *c;
+    struct outbuf *ob;
+    size_t *slice_end;
+    unsigned int kw_first;
+    unsigned int kw_next;               /* first keyword whose slice is still open */
+    size_t traced;                      /* debug: labels whose line has been announced */
+};
+
+static void close_slices(struct tile_out *to, unsigned int upto)
+{
+    for (; to->kw_next < upto; to->kw_next++) {
+        to->slice_end[to->kw_next - to->kw_first] = to->ob->len;
+    }
+}
+
+/* Debug trace: one line per subdomain a keyword is tried against, up to label `upto`; shard-tagged like the rows */
+static void trace_lines(struct tile_out *to, unsigned int k, size_t upto)
+{
+    const typosee_batch *b = &to->c->labels;
+    const struct chunk *c = to->c;
+
+    for (; to->traced < upto; to->traced++) {
+        if (to->traced == 0 || b->line[to->traced] != b->line[to->traced - 1]) {
+            if (to->pl->shards) {
+                ob_printf(to->ob, "%u,%llu,", k, c->pos + c->line_rel[b->line[to->traced]]);
+            }
+            ob_printf(to->ob, "%s, %llu for [%s]\n", typosee_set_keyword(to->pl->keywords, k),
+                c->first_line + b->line[to->traced], c->text + c->line_off[b->line[to->traced]]);
+        }
+    }
+}
+
+static int pick_after(const struct pick *a, const struct pick *b)
+{
+    if (a->distance != b->distance) {
+        return a->distance > b->distance;
+    }
+    return a->pos != b->pos ? a->pos > b->pos : a->label > b->label;
+}
+
+static void nearest_down(struct nearest *nr, unsigned int i)
+{
+    unsigned int c;
+    struct pick tmp;
+
+    while ((c = 2 * i + 1) < nr->n) {
+        if (c + 1 < nr->n && pick_after(&nr->heap[c + 1], &nr->heap[c])) {
+            c++;
+        }
+        if (!pick_after(&nr->heap[c], &nr->heap[i])) {
+            break;
+        }
+        tmp = nr->heap[c];
+        nr->heap[c] = nr->heap[i];
+        nr->heap[i] = tmp;
+        i = c;
+    }
+}
+
+/*
+ * Keeps the row just formatted at the end of ob if it is among the keyword's closest
+ * so far, and takes it back out of ob either way. Once the heap is full its worst
+ * distance is the threshold the keyword's later chunks are matched under.
+ */
+static void nearest_offer(const struct pipeline *pl, unsigned int k, struct outbuf *ob, size_t start, struct pick *p)
+{
+    struct nearest *nr = &pl->nearest[k];
+    unsigned int i;
+
+    pthread_mutex_lock(&nr->lock);
+    if (nr->n < pl->top_labels || pick_after(&nr->heap[0], p)) {
+        p->len = ob->len - start;
+        p->row = xmalloc(p->len);
+        memcpy(p->row, ob->buf + start, p->len);
+        if (nr->n < pl->top_labels) {
+            for (i = nr->n++; i > 0 && pick_after(p, &nr->heap[(i - 1) / 2]); i = (i - 1) / 2) {
+                nr->heap[i] = nr->heap[(i - 1) / 2];
+            }
+            nr->heap[i] = *p;
+        }
+        else {
+            free(nr->heap[0].row);
+            nr->heap[0] = *p;
+            nearest_down(nr, 0);
+        }
+        if (nr->n == pl->top_labels) {
+            atomic_store(&nr->bound, nr->heap[0].distance);
+        }
+    }
+    pthread_mutex_unlock(&nr->lock);
+    ob->len = start;
+}
+
+static int format_match(const typosee_match *m, void *ctx)
+{
+    struct tile_out *to = ctx;
+    const struct pipeline *pl = to->pl;
+    const struct chunk *c = to->c;
+    struct outbuf *ob = to->ob;
+    size_t start = ob->len;
+    struct pick p;
+    unsigned int i;
+    const char *keyWord = typosee_set_keyword(pl->keywords, m->keyword);
+    const char *token = c->labels.arena + c->labels.off[m->label];
+    const char *line = c->text + c->line_off[c->labels.line[m->label]];
+
+    close_slices(to, m->keyword);
+    if (pl->debug) {
+        trace_lines(to, m->keyword, m->label + 1);
+    }
+    if (pl->shards) {
+        /* shard tag: the merge tool restores serial order from (keyword, input offset) */
+        ob_printf(ob, "%u,%llu,", m->keyword, c->pos + c->line_rel[c->labels.line[m->label]]);
+    }
+    if (m->homoglyph) {
+        ob_printf(ob, "h,%s,%s,%s", keyWord, token, line);
+    }
+    else if (pl->costs) {
+        ob_printf(ob, "%u.%u,%s,%s,%s", m->distance / TYPOSEE_COST_UNIT, m->distance % TYPOSEE_COST_UNIT, keyWord, token, line);
+    }
+    else {
+        ob_printf(ob, "%d,%s,%s,%s", m->distance, keyWord, token, line);
+    }
+    if (pl->substring) {
+        ob_printf(ob, ",%zu", m->offset);
+    }
+    ob_printf(ob, "\n");
+
+    if (pl->debug && pl->costs) {
+        ob_printf(ob, "K: [%s], H: [%s] in [%s]\n\tDistance is %u.%u:\n", keyWord, token, line,
+            m->distance / TYPOSEE_COST_UNIT, m->distance % TYPOSEE_COST_UNIT);
+    }
+    else if (pl->debug) {
+        ob_printf(ob, "K: [%s], H: [%s] in [%s]\n\tDistance is %d:\n", keyWord, token, line, m->distance);
+    }
+    if (pl->verbose && m->script) {
+        for (i = 0; i < m->edits; i++) {
+            print(ob, &m->script[i]);
+        }
+    }
+    if (pl->top_labels) {
+        p.distance = m->homoglyph ? 0 : m->distance;
+        p.pos = c->pos + c->line_rel[c->labels.line[m->label]];
+        p.label = m->label;
+        nearest_offer(pl, m->keyword, ob, start, &p);
+    }
+    return 0;
+}
+
+/* With --top-labels each keyword starts from its own bound, which the library tightens from there */
+static void match_block(const struct pipeline *pl, typosee_workspace *ws, unsigned int *bounds, struct tile_out *to,
+        unsigned int kw_first, unsigned int kw_count)
+{
+    unsigned int k;
+
+    if (pl->top_labels) {
+        for (k = kw_first; k < kw_first + kw_count; k++) {
+            bounds[k] = atomic_load(&pl->nearest[k].bound);
+        }
+    }
+    if (typosee_match_block(pl->keywords, kw_first, kw_count, ws, &to->c->labels,
+            pl->threshold, format_match, to) < 0) {
+        fprintf(stderr, "[ERR]: Out of memory\n");
+        exit(1);
+    }
+}
+
+/*
+ * The whole tile goes to the library as one batch. Debug output traces every
+ * (keyword, subdomain) pair, so there the keywords go one at a time and the lines
+ * without a match are announced once each keyword is done.
+ */
+static void match_tile(const struct pipeline *pl, typosee_workspace *ws, unsigned int *bounds, const struct tile *t,
+        struct outbuf *ob, size_t *slice_end)
+{
+    const struct chunk *c = t->c;
+    struct tile_out to = { pl, c, ob, slice_end, t->kw_first, t->kw_first, 0 };
+    unsigned int k;
+
+    if (!pl->debug) {
+        match_block(pl, ws, bounds, &to, t->kw_first, t->kw_count);
+    }
+    else {
+        for (k = t->kw_first; k < t->kw_first + t->kw_count; k++) {
+            close_slices(&to, k);
+            to.traced = 0;
+            match_block(pl, ws, bounds, &to, k, 1);
+            trace_lines(&to, k, c->labels.n);
+        }
+    }
+    close_slices(&to, t->kw_first + t->kw_count);
+}
+
+/* Empty blocks still go to the writer when ordering, since they advance its position */
+static void run_tile(struct worker *w, struct tile *t)
+{
+    struct pipeline *pl = w->pl;
+    struct chunk *c = t->c;
+    struct block *b = xmalloc(sizeof(*b));
+
+    memset(b, 0, sizeof(*b));
+    b->pos = c->pos;
+    b->end = c->end;
+    b->kw_first = t->kw_first;
+    b->kw_count = t->kw_count;
+    b->slice_end = xmalloc((t->kw_count ? t->kw_count : 1) * sizeof(size_t));
+    match_tile(pl, w->ws, w->bounds, t, &b->ob, b->slice_end);
+    if (b->ob.len || !pl->unordered) {
+        ring_push(&pl->blocks, b);
+    }
+    else {
+        free(b->slice_end);
+        free(b);
+    }
+    if (atomic_fetch_sub(&c->tiles_left, 1) == 1) {
+        chunk_free(c);
+    }
+    atomic_fetch_sub(&pl->outstanding, 1);
+}
+
+static struct tile *steal_tile(struct worker *w)
+{
+    struct pipeline *pl = w->pl;
+    struct tile *t = NULL;
+    unsigned int i;
+
+    for (i = 1; i < pl->nworkers && t == NULL; i++) {
+        t = deque_steal(&pl->workers[(w->id + i) % pl->nworkers].tiles);
+    }
+    return t;
+}
+
+/*
+ * Worker loop: run our own tiles first, then steal other workers' tiles, and only
+ * then cut a new chunk into tiles, so the number of chunks in flight stays small.
+ * A chunk being cut counts as outstanding work, which keeps the others from
+ * concluding there is nothing left while it is being tokenised.
+ */
+static void *worker_stage(void *arg)
+{
+    struct worker *w = arg;
+    struct pipeline *pl = w->pl;
+    unsigned long long start = now_ns(), t0, c0;
+    unsigned int b, idle = 0;
+    struct chunk *c;
+    struct tile *t;
+
+    for (;;) {
+        if ((t = deque_pop(&w->tiles)) == NULL && (t = steal_tile(w)) != NULL) {
+            w->tiles_stolen++;
+        }
+        if (t) {
+            t0 = now_ns();
+            run_tile(w, t);
+            w->busy_ns += now_ns() - t0;
+            w->tiles_run++;
+            idle = 0;
+            continue;
+        }
+
+        atomic_fetch_add(&pl->outstanding, 1);
+        t0 = now_ns();
+        c0 = cpu_ns();
+        if ((c = next_chunk(w)) != NULL) {
+            parse_chunk(pl, c);
+            w->labels += c->labels.n;
+            atomic_fetch_add(&pl->shard_lines, c->kept);
+            atomic_fetch_add(&pl->outstanding, pl->nblocks);
+            for (b = 0; b < pl->nblocks; b++) {
+                deque_push(&w->tiles, &c->tiles[b]);
+            }
+            atomic_fetch_sub(&pl->outstanding, 1);
+            w->busy_ns += now_ns() - t0;
+            w->parse.wall_ns += now_ns() - t0;
+            w->parse.cpu_ns += cpu_ns() - c0;
+            w->chunks++;
+            idle = 0;
+            continue;
+        }
+        atomic_fetch_sub(&pl->outstanding, 1);
+
+        if (input_exhausted(pl) && atomic_load(&pl->outstanding) == 0) {
+            break;
+        }
+        backoff(&idle);
+    }
+    w->wall_ns = now_ns() - start;
+    ring_producer_done(&pl->blocks);
+    return NULL;
+}
+
+static void flush_out(struct pipeline *pl)
+{
+    unsigned long long t0 = now_ns();
+    size_t done = 0;
+    ssize_t n;
+
+    while (done < pl->out.len) {
+        if ((n = write(STDOUT_FILENO, pl->out.buf + done, pl->out.len - done)) < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            fprintf(stderr, "[ERR]: Unable to write output\n");
+            exit(1);
+        }
+        done += n;
+    }
+    pl->bytes_written += pl->out.len;
+    pl->out.len = 0;
+    pl->write.wall_ns += now_ns() - t0;
+}
+
+/* Rows are gathered into WRITE_BYTES before each write(), bypassing stdio on the hot path */
+static void write_out(struct pipeline *pl, const char *data, size_t len)
+{
+    if (len == 0) {
+        return;
+    }
+    if (pl->out.len + len > WRITE_BYTES) {
+        flush_out(pl);
+    }
+    ob_reserve(&pl->out, len);
+    memcpy(pl->out.buf + pl->out.len, data, len);
+    pl->out.len += len;
+}
+
+/*
+ * Debug: a serial run read keyword k, and for the first keyword the header line, just
+ * before matching it, so the announcement goes out right ahead of the keyword's rows.
+ * Of a sharded run only shard 0 announces, tagged with input offset 0 so the merge
+ * puts it ahead of every shard's rows for the keyword.
+ */
+static void announce(struct pipeline *pl, unsigned int k, int header)
+{
+    if (pl->shards && pl->shard) {
+        return;
+    }
+    if (pl->shards) {
+        ob_printf(&pl->out, "%u,0,", k);
+    }
+    ob_printf(&pl->out, "[DEBUG] ReadLine [%s]\n", typosee_set_keyword(pl->keywords, k));
+    if (header) {
+        if (pl->shards) {
+            ob_printf(&pl->out, "%u,0,", k);
+        }
+        ob_printf(&pl->out, "[DEBUG]: lineNum = %d\n", 1);
+    }
+}
+
+static void block_free(struct block *b)
+{
+    free(b->ob.buf);
+    free(b->slice_end);
+    free(b);
+}
+
+/* A keyword's rows for one chunk, parked until the writer gets to them */
+struct pending {
+    unsigned long long pos;
+    unsigned long long end;
+    size_t len;
+    char *data;                         /* NULL once spilled */
+    off_t off;                          /* where in the spill file */
+};
+
+struct pending_list {
+    struct pending *v;
+    size_t n;
+    size_t cap;
+};
+
+/*
+ * Reorder buffer. A serial run prints every row of keyword 0 in file order, then
+ * every row of keyword 1, and so on. Keyword 0 streams straight out whenever the
+ * chunk at the current input position arrives; everything else has to wait for the
+ * end of the input. Parked rows stay in memory up to REORDER_MEM and spill to an
+ * anonymous temporary file beyond that.
+ */
+struct reorder {
+    unsigned long long next;            /* input position keyword 0 has been written up to */
+    struct pending_list first;          /* keyword 0, a min-heap on pos */
+    struct pending_list *rest;          /* keywords 1 .. count-1, sorted at the end */
+    FILE *spill;
+    off_t spill_len;
+    size_t mem;
+    size_t mem_peak;
+};
+
+static void park(struct reorder *ro, struct pending_list *l, const struct block *b, const char *data, size_t len)
+{
+    struct pending *p;
+
+    if (l->n == l->cap) {
+        l->cap = l->cap ? l->cap * 2 : 16;
+        l->v = xrealloc(l->v, l->cap * sizeof(struct pending));
+    }
+    p = &l->v[l->n++];
+    p->pos = b->pos;
+    p->end = b->end;
+    p->len = len;
+    p->data = NULL;
+    p->off = 0;
+    if (len == 0) {
+        return;
+    }
+    if (ro->mem + len <= REORDER_MEM) {
+        p->data = xmalloc(len);
+        memcpy(p->data, data, len);
+        ro->mem += len;
+        if (ro->mem > ro->mem_peak) {
+            ro->mem_peak = ro->mem;
+        }
+        return;
+    }
+    if (ro->spill == NULL && (ro->spill = tmpfile()) == NULL) {
+        fprintf(stderr, "[ERR]: Unable to create reorder spill file\n");
+        exit(1);
+    }
+    if (pwrite(fileno(ro->spill), data, len, ro->spill_len) != (ssize_t)len) {
+        fprintf(stderr, "[ERR]: Unable to write reorder spill file\n");
+        exit(1);
+    }
+    p->off = ro->spill_len;
+    ro->spill_len += len;
+}
+
+static void emit(struct pipeline *pl, struct reorder *ro, struct pending *p)
+{
+    char buf[65536];
+    size_t done, n;
+
+    if (p->data) {
+        write_out(pl, p->data, p->len);
+        ro->mem -= p->len;
+        free(p->data);
+        return;
+    }
+    for (done = 0; done < p->len; done += n) {
+        n = p->len - done < sizeof(buf) ? p->len - done : sizeof(buf);
+        if (pread(fileno(ro->spill), buf, n, p->off + done) != (ssize_t)n) {
+            fprintf(stderr, "[ERR]: Unable to read reorder spill file\n");
+            exit(1);
+        }
+        write_out(pl, buf, n);
+    }
+}
+
+static void heap_push(struct pending_list *h)
+{
+    size_t i = h->n - 1, parent;
+    struct pending tmp;
+
+    while (i > 0 && h->v[parent = (i - 1) / 2].pos > h->v[i].pos) {
+        tmp = h->v[parent];
+        h->v[parent] = h->v[i];
+        h->v[i] = tmp;
+        i = parent;
+    }
+}
+
+static struct pending heap_pop(struct pending_list *h)
+{
+    struct pending top = h->v[0], tmp;
+    size_t i = 0, c;
+
+    h->v[0] = h->v[--h->n];
+    while ((c = 2 * i + 1) < h->n) {
+        if (c + 1 < h->n && h->v[c + 1].pos < h->v[c].pos) {
+            c++;
+        }
+        if (h->v[i].pos <= h->v[c].pos) {
+            break;
+        }
+        tmp = h->v[c];
+        h->v[c] = h->v[i];
+        h->v[i] = tmp;
+        i = c;
+    }
+    return top;
+}
+
+static int pending_cmp(const void *a, const void *b)
+{
+    const struct pending *x = a, *y = b;
+
+    return x->pos < y->pos ? -1 : x->pos > y->pos;
+}
+
+static void writer_ordered(struct pipeline *pl)
+{
+    struct reorder ro;
+    struct pending p;
+    struct block *b;
+    unsigned int i, k;
+    size_t start;
+    int announced = 0;
+
+    memset(&ro, 0, sizeof(ro));
+    ro.next = pl->input_start;
+    ro.rest = xmalloc((pl->nkeywords ? pl->nkeywords : 1) * sizeof(struct pending_list));
+    memset(ro.rest, 0, (pl->nkeywords ? pl->nkeywords : 1) * sizeof(struct pending_list));
+
+    while ((b = ring_pop(&pl->blocks)) != NULL) {
+        if (pl->debug && !announced && b->kw_first == 0) {
+            announce(pl, 0, 1);
+            announced = 1;
+        }
+        for (i = 0; i < b->kw_count; i++) {
+            k = b->kw_first + i;
+            start = i ? b->slice_end[i - 1] : 0;
+            if (k > 0) {
+                if (b->slice_end[i] > start) {
+                    park(&ro, &ro.rest[k], b, b->ob.buf + start, b->slice_end[i] - start);
+                }
+                continue;
+            }
+            if (b->pos != ro.next) {
+                park(&ro, &ro.first, b, b->ob.buf, b->slice_end[0]);
+                heap_push(&ro.first);
+                continue;
+            }
+            write_out(pl, b->ob.buf, b->slice_end[0]);
+            ro.next = b->end;
+            while (ro.first.n && ro.first.v[0].pos == ro.next) {
+                p = heap_pop(&ro.first);
+                emit(pl, &ro, &p);
+                ro.next = p.end;
+            }
+        }
+        block_free(b);
+    }
+
+    /* Only reachable with gaps in the input positions; keep file order regardless */
+    while (ro.first.n) {
+        p = heap_pop(&ro.first);
+        emit(pl, &ro, &p);
+    }
+    if (pl->debug && !announced && pl->nkeywords) {
+        announce(pl, 0, pl->lineNum || pl->map);
+    }
+    for (k = 1; k < pl->nkeywords; k++) {
+        if (pl->debug) {
+            announce(pl, k, 0);
+        }
+        if (ro.rest[k].n == 0) {
+            continue;
+        }
+        qsort(ro.rest[k].v, ro.rest[k].n, sizeof(struct pending), pending_cmp);
+        for (i = 0; i < ro.rest[k].n; i++) {
+            emit(pl, &ro, &ro.rest[k].v[i]);
+        }
+        free(ro.rest[k].v);
+    }
+    free(ro.first.v);
+    free(ro.rest);
+    if (ro.spill) {
+        fclose(ro.spill);
+    }
+    pl->reorder_peak = ro.mem_peak;
+    pl->spilled = ro.spill_len;
+}
+
+/* Runs on the main thread: the only place match rows reach stdout */
+static int pick_cmp(const void *a, const void *b)
+{
+    return pick_after(a, b) - pick_after(b, a);
+}
+
+/* --top-labels: every worker is done, so each keyword's heap holds its closest rows of the whole input */
+static void write_nearest(struct pipeline *pl)
+{
+    struct nearest *nr;
+    unsigned int k, i;
+
+    for (k = 0; k < pl->nkeywords; k++) {
+        nr = &pl->nearest[k];
+        qsort(nr->heap, nr->n, sizeof(struct pick), pick_cmp);
+        for (i = 0; i < nr->n; i++) {
+            write_out(pl, nr->heap[i].row, nr->heap[i].len);
+            free(nr->heap[i].row);
+        }
+        free(nr->heap);
+        pthread_mutex_destroy(&nr->lock);
+    }
+    free(pl->nearest);
+}
+
+static void writer_stage(struct pipeline *pl)
+{
+    unsigned long long c0 = cpu_ns();
+    struct block *b;
+    unsigned int k, blocks = 0;
+
+    fflush(stdout);
+    if (!pl->unordered) {
+        writer_ordered(pl);
+    }
+    else {
+        /* No keyword order to keep here, so the announcements all go first */
+        for (k = 0; pl->debug && k < pl->nkeywords; k++) {
+            announce(pl, k, 0);
+        }
+        while ((b = ring_pop(&pl->blocks)) != NULL) {
+            if (pl->debug && !blocks++ && !(pl->shards && pl->shard)) {
+                ob_printf(&pl->out, pl->shards ? "0,0,[DEBUG]: lineNum = %d\n" : "[DEBUG]: lineNum = %d\n", 1);
+            }
+            write_out(pl, b->ob.buf, b->ob.len);
+            block_free(b);
+        }
+    }
+    if (pl->top_labels) {
+        write_nearest(pl);
+    }
+    flush_out(pl);
+    free(pl->out.buf);
+    pl->write.cpu_ns = cpu_ns() - c0;
+}
+
+/* Load-balance, stage time and counter report for --stats; goes to stderr so it never mixes with the CSV */
+static void print_stats(const struct pipeline *pl)
+{
+    const struct worker *w;
+    typosee_stats ks;
+    typosee_time parse;
+    struct rusage ru;
+    unsigned long long labels = 0, lines;
+    unsigned int i;
+    double secs;
+
+    fprintf(stderr, "[STATS] threads %u, keyword block %u of %u keywords, chunk %u bytes\n",
+        pl->nworkers, pl->kw_block, pl->nkeywords, CHUNK_BYTES);
+    for (i = 0; i < pl->nworkers; i++) {
+        w = &pl->workers[i];
+        fprintf(stderr, "[STATS] thread %u: busy %.3fs, idle %.3fs (%.1f%% busy), chunks %lu, tiles %lu, stolen tiles %lu, stolen ranges %lu\n",
+            i, w->busy_ns / 1e9, (w->wall_ns - w->busy_ns) / 1e9,
+            w->wall_ns ? 100.0 * w->busy_ns / w->wall_ns : 0.0, w->chunks, w->tiles_run, w->tiles_stolen, w->ranges_stolen);
+    }
+    memset(&ks, 0, sizeof(ks));
+    for (i = 0; i < pl->nworkers; i++) {
+        typosee_workspace_stats(pl->workers[i].ws, &ks);
+    }
+    fprintf(stderr, "[STATS] kernel %s: %llu pairs in %llu steps of %u lanes, %.1f%% lane utilisation; %llu pairs by full matrix, "
+        "%llu punycode pairs by code point\n",
+        ks.isa, (unsigned long long)ks.kernel_pairs, (unsigned long long)ks.kernel_steps, ks.lanes,
+        ks.kernel_steps ? 100.0 * ks.lane_steps / (ks.kernel_steps * ks.lanes) : 0.0,
+        (unsigned long long)ks.matrix_pairs, (unsigned long long)ks.idn_pairs);
+    fprintf(stderr, "[STATS] output ring: %zu slots, peak depth %zu, mean depth %.1f, "
+        "producer stalls %lu, writer stalls %lu, %llu bytes written\n",
+        pl->blocks.mask + 1, pl->blocks.depth_peak,
+        pl->blocks.pops ? (double)pl->blocks.depth_sum / pl->blocks.pops : 0.0,
+        (unsigned long)atomic_load(&pl->blocks.push_stalls), pl->blocks.pop_stalls, pl->bytes_written);
+    if (!pl->unordered) {
+        fprintf(stderr, "[STATS] reorder buffer: peak %zu bytes in memory, %llu bytes spilled\n",
+            pl->reorder_peak, pl->spilled);
+    }
+
+    /* Stage times are summed over the threads that ran them */
+    memset(&parse, 0, sizeof(parse));
+    for (i = 0; i < pl->nworkers; i++) {
+        parse.wall_ns += pl->workers[i].parse.wall_ns;
+        parse.cpu_ns += pl->workers[i].parse.cpu_ns;
+        labels += pl->workers[i].labels;
+    }
+    fprintf(stderr, "[STATS] stage parse: %.3fs wall, %.3fs cpu\n", parse.wall_ns / 1e9, parse.cpu_ns / 1e9);
+    fprintf(stderr, "[STATS] stage filter: %.3fs wall, %.3fs cpu\n", ks.filter.wall_ns / 1e9, ks.filter.cpu_ns / 1e9);
+    fprintf(stderr, "[STATS] stage distance: %.3fs wall, %.3fs cpu\n", ks.distance.wall_ns / 1e9, ks.distance.cpu_ns / 1e9);
+    fprintf(stderr, "[STATS] stage output: %.3fs wall, %.3fs cpu (formatting rows %.3fs / %.3fs, writer %.3fs in write() / %.3fs cpu)\n",
+        (ks.callback.wall_ns + pl->write.wall_ns) / 1e9, (ks.callback.cpu_ns + pl->write.cpu_ns) / 1e9,
+        ks.callback.wall_ns / 1e9, ks.callback.cpu_ns / 1e9, pl->write.wall_ns / 1e9, pl->write.cpu_ns / 1e9);
+    lines = pl->shards ? atomic_load(&pl->shard_lines) : pl->lines;
+    fprintf(stderr, "[STATS] counts: %llu lines, %llu labels, %llu keyword x label pairs, %llu rejected by length, "
+        "%llu repeats of a label already matched, %llu DP cells, %llu exact lookups, %llu matches (%llu homoglyphs)\n",
+        lines, labels, (unsigned long long)ks.pairs, (unsigned long long)ks.length_rejects, (unsigned long long)ks.repeats,
+        (unsigned long long)ks.cells, (unsigned long long)ks.exact_lookups, (unsigned long long)ks.matches,
+        (unsigned long long)ks.homoglyphs);
+    if (pl->clusters) {
+        fprintf(stderr, "[STATS] clusters: %d of %u keywords anchored within %u edits; %llu of the %llu distances of the "
+            "keyword x label loop skipped by the triangle inequality (%.1f%%)\n",
+            pl->anchored, pl->nkeywords, pl->radius, (unsigned long long)ks.triangle_skips, (unsigned long long)ks.pairs,
+            ks.pairs ? 100.0 * ks.triangle_skips / ks.pairs : 0.0);
+    }
+    getrusage(RUSAGE_SELF, &ru);
+    fprintf(stderr, "[STATS] process: %.3fs wall, %.3fs user, %.3fs sys; %llu bytes read, %llu bytes written\n",
+        pl->wall_ns / 1e9, ru.ru_utime.tv_sec + ru.ru_utime.tv_usec / 1e6, ru.ru_stime.tv_sec + ru.ru_stime.tv_usec / 1e6,
+        pl->bytes_read, pl->bytes_written);
+    secs = pl->wall_ns ? pl->wall_ns / 1e9 : 1e-9;
+    fprintf(stderr, "[STATS] throughput: %llu bytes, %llu lines in %.3fs: %.1f MB/s, %.0f lines/s\n",
+        pl->bytes_read, lines, pl->wall_ns / 1e9, pl->bytes_read / 1e6 / secs, lines / secs);
+}
+
+/* A positive count given on the command line, or 0 if the text is not one */
+static unsigned int parse_count(const char *s)
+{
+    unsigned long n;
+    char *end;
+
+    if (!isdigit((unsigned char)*s)) {
+        return 0;
+    }
+    errno = 0;
+    n = strtoul(s, &end, 10);
+    return *end || errno || n > UINT_MAX ? 0 : (unsigned int)n;
+}
+
+int main(int argc, char **argv)
+{
+    FILE *fp, *kfp;
+    struct pipeline pl;
+    struct stat st;
+    pthread_t reader;
+    typosee_psl *compiled;
+    int arg;
+    unsigned int i, jobs = 1, nargs = 0, threshold, stats = 0, unordered = 0, homoglyphs = 0, substring = 0, osa = 0, shard = 0, shards = 0;
+    unsigned int top = 0, top_labels = 0, clusters = 0, radius = 0;
+    char *args[4] = { NULL, NULL, NULL, NULL }, *shard_by = "hash", *spec, *isa = NULL, *psl = NULL, *psl_save = NULL, *costs = NULL;
+    char *top_spec = NULL, *top_labels_spec = NULL;
+    struct limit global;
+
+    for (arg = 1; arg < argc; arg++)
+    	{
+    	if(!strcmp(argv[arg], "--stats"))
+    		stats = 1;
+    	else if(!strcmp(argv[arg], "--unordered"))
+    		unordered = 1;
+    	else if(!strcmp(argv[arg], "--homoglyphs"))
+    		homoglyphs = 1;
+    	else if(!strcmp(argv[arg], "--osa"))
+    		osa = 1;
+    	else if(!strcmp(argv[arg], "--substring"))
+    		substring = 1;
+    	else if(!strcmp(argv[arg], "--substring=fqdn"))
+    		substring = 2;
+    	else if(!strncmp(argv[arg], "--isa", 5))
+    		isa = argv[arg][5] == '=' ? argv[arg] + 6 : (arg + 1 < argc ? argv[++arg] : "");
+    	else if(!strncmp(argv[arg], "--psl-save", 10))
+    		psl_save = argv[arg][10] == '=' ? argv[arg] + 11 : (arg + 1 < argc ? argv[++arg] : "");
+    	else if(!strncmp(argv[arg], "--psl", 5))
+    		psl = argv[arg][5] == '=' ? argv[arg] + 6 : (arg + 1 < argc ? argv[++arg] : "");
+    	else if(!strncmp(argv[arg], "--costs", 7))
+    		costs = argv[arg][7] == '=' ? argv[arg] + 8 : (arg + 1 < argc ? argv[++arg] : "");
+    	else if(!strcmp(argv[arg], "--top-labels") || !strncmp(argv[arg], "--top-labels=", 13))
+    		top_labels_spec = argv[arg][12] == '=' ? argv[arg] + 13 : (arg + 1 < argc ? argv[++arg] : "");
+    	else if(!strcmp(argv[arg], "--top") || !strncmp(argv[arg], "--top=", 6))
+    		top_spec = argv[arg][5] == '=' ? argv[arg] + 6 : (arg + 1 < argc ? argv[++arg] : "");
+    	else if(!strncmp(argv[arg], "--clusters", 10))
+    		clusters = 1, radius = atoi(argv[arg][10] == '=' ? argv[arg] + 11 : (arg + 1 < argc ? argv[++arg] : "0"));
+    	else if(!strncmp(argv[arg], "--shard-by", 10))
+    		shard_by = argv[arg][10] == '=' ? argv[arg] + 11 : (arg + 1 < argc ? argv[++arg] : "");
+    	else if(!strncmp(argv[arg], "--shard", 7))
+    		{
+    		spec = argv[arg][7] == '=' ? argv[arg] + 8 : (arg + 1 < argc ? argv[++arg] : "");
+    		if(sscanf(spec, "%u/%u", &shard, &shards) != 2)
+    			shards = 0, shard = 1;
+    		}
+    	else if(!strncmp(argv[arg], "-j", 2))
+    		jobs = atoi(argv[arg][2] ? argv[arg] + 2 : (arg + 1 < argc ? argv[++arg] : "0"));
+    	else if(nargs < 4)
+    		args[nargs++] = argv[arg];
+    	}
+
+    if(psl_save && psl)
+    	{
+    	if((compiled = typosee_psl_load(psl)) == NULL || typosee_psl_save(compiled, psl_save))
+    		{
+    		printf("[ERR]: Unable to compile %s into %s\n", psl, psl_save);
+    		return 1;
+    		}
+    	typosee_psl_free(compiled);
+    	return 0;
+    	}
+
+    if(nargs < 3)
+    	{
+	printf("\ntyposee by Ed@whoisxmlapi.com.\n\n\t");
+	printf("args: subdomain_filename keyword_filename Threshhold# [v:q] [-j N] [--unordered] [--stats] [--shard i/n [--shard-by hash:range]] [--isa name]\n\t"
+	       "      [--psl list] [--homoglyphs] [--substring[=fqdn]] [--osa] [--costs file] [--top K | --top-labels K] [--clusters R]\n\t"
+	       "where 'q'=quiet, 'v'=verbose, Threshhold# 0 = exact hits only, by hash, N=worker threads,\n\t"
+	       "i/n=process only shard i of n (merge with typosee_merge),\n\t"
+	       "name=avx512:avx2:sse4.1:scalar to pin the matching kernel (default: $TYPOSEE_ISA, else the best this CPU runs),\n\t"
+	       "list=Public Suffix List, so only the labels in front of the public suffix are matched (default: all but the last),\n\t"
+	       "--homoglyphs also reports labels that look like a keyword (paypa1, rnicrosoft) with 'h' for the distance,\n\t"
+	       "--substring matches the keyword against the closest part of each label (or of the whole name, =fqdn) and\n\t"
+	       "adds the offset it was found at as a last column, --osa counts swapped neighbours (paypla) as one edit,\n\t"
+	       "file=edit costs (sub 0 o 0.3, keyboard 0.5, ...), which make Threshhold# and the distances decimal (1.5),\n\t"
+	       "--top keeps the K closest keywords of each label and --top-labels the K closest rows of each keyword\n\t"
+	       "over the whole input, printed at the end, with Threshhold# as a ceiling.\n\t"
+	       "Threshhold# may be a share of each keyword's length (20%%), and a keyword line may end in its own (paypal,1 or paypal,20%%),\n\t"
+	       "--clusters anchors keywords on an earlier one within R edits and skips labels the anchor's distance rules out\n\n\t");
+	printf("or:   --psl public_suffix_list.dat --psl-save compiled  to compile the list into an image --psl mmaps directly\n\n");
+	return 0;
+	}
+	
+    /* Weighted thresholds are in tenths of an edit: 1.5 is 15; a ratio is only worked out per keyword */
+    if(parse_limit(args[2], &global) < 0)
+    	{
+    	printf("[ERR] Invalid threshold number. Must be between 0 and 100, or 0%% and 100%%.\n");
+    	return 0;
+    	}
+    threshold = limit_units(&global, 0, costs != NULL);
+
+    if(jobs < 1 || jobs > 1024)
+    	{
+    	printf("[ERR] Invalid number of worker threads. Must be between 1 and 1024.\n");
+    	return 0;
+    	}
+
+    if(shard >= shards && (shard || shards))
+    	{
+    	printf("[ERR] Invalid shard. Use --shard i/n with 0 <= i < n.\n");
+    	return 0;
+    	}
+
+    if(top_spec && (top = parse_count(top_spec)) == 0)
+    	{
+    	printf("[ERR] Invalid --top %s. Must be a positive integer.\n", top_spec);
+    	return 0;
+    	}
+
+    if(top_labels_spec && (top_labels = parse_count(top_labels_spec)) == 0)
+    	{
+    	printf("[ERR] Invalid --top-labels %s. Must be a positive integer.\n", top_labels_spec);
+    	return 0;
+    	}
+
+    if(top && top_labels)
+    	{
+    	printf("[ERR] --top and --top-labels are exclusive.\n");
+    	return 0;
+    	}
+
+    /* --top-labels ranks rows across the whole input, which one shard doesn't see; debug traces every pair */
+    if((top || top_labels) && (shards || (args[3] && args[3][0] == 'd')))
+    	{
+    	printf("[ERR] --top and --top-labels take q or v output and no --shard.\n");
+    	return 0;
+    	}
+
+    if(strcmp(shard_by, "hash") && strcmp(shard_by, "range"))
+    	{
+    	printf("[ERR] Invalid --shard-by %s. Must be hash or range.\n", shard_by);
+    	return 0;
+    	}
+
+    if(!isa)
+    	isa = getenv("TYPOSEE_ISA");
+    if(isa && typosee_set_isa(isa))
+    	{
+    	printf("[ERR] Invalid --isa %s. Must be avx512, avx2, sse4.1 or scalar, and supported by this CPU.\n", isa);
+    	return 0;
+    	}
+    
+    memset(&pl, 0, sizeof(pl));
+    pl.threshold = threshold;
+    pl.stats = stats;
+    pl.unordered = unordered;
+    pl.homoglyphs = homoglyphs;
+    pl.substring = substring;
+    pl.osa = osa;
+    pl.top = top;
+    pl.top_labels = top_labels;
+    pl.clusters = clusters;
+    pl.radius = radius;
+    pl.shard = shard;
+    pl.shards = shards;
+    pl.shard_by_range = shards && !strcmp(shard_by, "range");
+
+    if(args[3] && args[3][0] == 'v')
+    	pl.verbose = 1;
+    if(args[3] && args[3][0] == 'd')
+    	pl.debug = 1;
+    	
+    if( (fp = fopen(args[0], "rt")) == NULL)
+    	{
+    	printf("[ERR]: Unable to open %s\n", args[0]);
+    	return 0;
+    	}
+    	
+    if( (kfp = fopen(args[1], "rt")) == NULL)
+    	{
+    	printf("[ERR]: Unable to open %s\n", args[1]);
+    	return 0;
+    	}
+
+    if(costs && (pl.costs = typosee_costs_load(costs)) == NULL)
+    	{
+    	printf("[ERR]: Unable to load the edit costs %s\n", costs);
+    	return 0;
+    	}
+
+    if(psl && (pl.psl = typosee_psl_load(psl)) == NULL)
+    	{
+    	printf("[ERR]: Unable to load the public suffix list %s\n", psl);
+    	return 0;
+    	}
+    	
+    /* Debug output reports file line numbers, which the reader stage tracks; range shards need the mapping and count them there */
+    if((!pl.debug || pl.shard_by_range) && fstat(fileno(fp), &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0)
+    	{
+    	pl.map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fileno(fp), 0);
+    	if(pl.map == MAP_FAILED)
+    		pl.map = NULL;
+    	else
+    		{
+    		pl.map_len = st.st_size;
+    		madvise((void *)pl.map, pl.map_len, MADV_SEQUENTIAL);
+    		}
+    	}
+
+    if(pl.shard_by_range && !pl.map)
+    	{
+    	printf("[ERR] --shard-by range needs a regular, non-empty subdomain file.\n");
+    	return 0;
+    	}
+
+    if(pl.map)
+    	{
+    	pl.input_end = pl.map_len;
+    	if(pl.shard_by_range)
+    		{
+    		pl.input_start = align_to_line(pl.map, pl.map_len, (unsigned long long)pl.map_len * pl.shard / pl.shards);
+    		pl.input_end = align_to_line(pl.map, pl.map_len, (unsigned long long)pl.map_len * (pl.shard + 1) / pl.shards);
+    		}
+    	}
+
+    if(pl.shards)
+    	{
+    	printf("#shard,%u,%u,%s\n", pl.shard, pl.shards, pl.shard_by_range ? "range" : "hash");
+    	printf("keyword-index,input-offset,");
+    	}
+    printf("distance,keyword,fqdn-element,full-fqdn%s\n", pl.substring ? ",offset" : "");
+
+    pl.keywords = load_keywords(kfp, &global, pl.costs != NULL, &pl.thresholds, &pl.threshold);
+    pl.nkeywords = typosee_set_count(pl.keywords);
+    if(pl.clusters && (pl.anchored = typosee_set_clusters(pl.keywords, pl.radius)) < 0)
+    	{
+    	fprintf(stderr, "[ERR]: Out of memory\n");
+    	return 1;
+    	}
+
+    pl.fp = fp;
+    /* --top ranks every keyword for a label, so they go in one block */
+    pl.kw_block = pl.top && pl.nkeywords ? pl.nkeywords : keyword_block_size(pl.keywords);
+    pl.nblocks = pl.nkeywords ? (pl.nkeywords + pl.kw_block - 1) / pl.kw_block : 1;
+    pl.nworkers = jobs;
+    atomic_init(&pl.outstanding, 0);
+    atomic_init(&pl.input_done, 0);
+    atomic_init(&pl.shard_lines, 0);
+    queue_init(&pl.chunks, jobs * QUEUE_SLOTS);
+    if(pl.top_labels)
+    	{
+    	pl.nearest = xmalloc((pl.nkeywords ? pl.nkeywords : 1) * sizeof(struct nearest));
+    	for (i = 0; i < pl.nkeywords; i++)
+    		{
+    		pthread_mutex_init(&pl.nearest[i].lock, NULL);
+    		pl.nearest[i].heap = xmalloc(pl.top_labels * sizeof(struct pick));
+    		pl.nearest[i].n = 0;
+    		atomic_init(&pl.nearest[i].bound, pl.thresholds ? pl.thresholds[i] : pl.threshold);
+    		}
+    	}
+    ring_init(&pl.blocks, jobs * RING_SLOTS, jobs);
+
+    /* Each worker starts out owning an equal share of the input range; the rest is stolen as needed */
+    pl.workers = xmalloc(jobs * sizeof(struct worker));
+    memset(pl.workers, 0, jobs * sizeof(struct worker));
+    for (i = 0; i < jobs; i++)
+    	{
+    	pl.workers[i].pl = &pl;
+    	pl.workers[i].id = i;
+    	deque_init(&pl.workers[i].tiles, pl.nblocks);
+    	if((pl.workers[i].ws = typosee_workspace_new()) == NULL)
+    		{
+    		fprintf(stderr, "[ERR]: Out of memory\n");
+    		return 1;
+    		}
+    	typosee_workspace_timing(pl.workers[i].ws, pl.stats);
+    	typosee_workspace_scripts(pl.workers[i].ws, pl.verbose);    /* only verbose output prints them */
+    	typosee_workspace_homoglyphs(pl.workers[i].ws, pl.homoglyphs);
+    	typosee_workspace_substring(pl.workers[i].ws, pl.substring != 0);
+    	typosee_workspace_transpositions(pl.workers[i].ws, pl.osa);
+    	typosee_workspace_costs(pl.workers[i].ws, pl.costs);
+    	if(pl.top)
+    		typosee_workspace_top(pl.workers[i].ws, TYPOSEE_TOP_KEYWORDS, pl.top);
+    	else if(pl.top_labels)
+    		{
+    		typosee_workspace_top(pl.workers[i].ws, TYPOSEE_TOP_LABELS, pl.top_labels);
+    		pl.workers[i].bounds = xmalloc((pl.nkeywords ? pl.nkeywords : 1) * sizeof(unsigned int));
+    		typosee_workspace_bounds(pl.workers[i].ws, pl.workers[i].bounds);
+    		}
+    	pthread_mutex_init(&pl.workers[i].range_lock, NULL);
+    	if(pl.map)
+    		{
+    		pl.workers[i].pos = align_to_line(pl.map, pl.map_len, pl.input_start + (pl.input_end - pl.input_start) / jobs * i);
+    		pl.workers[i].end = i + 1 == jobs ? pl.input_end
+    			: align_to_line(pl.map, pl.map_len, pl.input_start + (pl.input_end - pl.input_start) / jobs * (i + 1));
+    		}
+    	}
+
+    pl.wall_ns = now_ns();
+    if(!pl.map)
+    	pthread_create(&reader, NULL, reader_stage, &pl);
+    for (i = 0; i < jobs; i++)
+    	pthread_create(&pl.workers[i].thread, NULL, worker_stage, &pl.workers[i]);
+
+    writer_stage(&pl);
+
+    if(!pl.map)
+    	pthread_join(reader, NULL);
+    for (i = 0; i < jobs; i++)
+    	{
+    	pthread_join(pl.workers[i].thread, NULL);
+    	pl.lineNum += pl.workers[i].lines;
+    	}
+    pl.wall_ns = now_ns() - pl.wall_ns;
+    pl.lines = pl.lineNum ? pl.lineNum - 1 : 0;     /* the header is not a subdomain line */
+    if(pl.map)
+    	pl.bytes_read = pl.input_end - pl.input_start;
+
+    if(pl.stats)
+    	print_stats(&pl);
+
+    if(pl.map)
+    	munmap((void *)pl.map, pl.map_len);
+    for (i = 0; i < jobs; i++)
+    	{
+    	free(pl.workers[i].tiles.buf);
+    	typosee_workspace_free(pl.workers[i].ws);
+    	free(pl.workers[i].bounds);
+    	pthread_mutex_destroy(&pl.workers[i].range_lock);
+    	}
+    free(pl.workers);
+    queue_destroy(&pl.chunks);
+    free(pl.blocks.slots);
+    typosee_set_free(pl.keywords);
+    free(pl.thresholds);
+    typosee_psl_free(pl.psl);
+    typosee_costs_free(pl.costs);
     
     fclose(fp);
     fclose(kfp);
  
-    printf("Total lines processed: %d\n", --lineNum);
+    if(pl.shards)
+    	printf("#total,%llu\n", atomic_load(&pl.shard_lines));
+    else
+    	printf("Total lines processed: %llu\n", pl.lines);
     
     return 0;
 }
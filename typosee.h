@@ -0,0 +1,323 @@
+/***************************/
+/* typosee.h               */
+/*                         ***********************************************************************************************************/
+/* libtyposee: the Levenshtein matcher behind typosee, for programs that want to embed it instead of running the tool on a file.     */
+/*                                                                                                                                   */
+/* Compile the keyword list once with typosee_set_compile(), give every thread its own typosee_workspace, collect labels (single     */
+/* FQDN elements such as "paypa1") into a typosee_batch, and hand the sealed batch to typosee_match_batch(). The callback is invoked */
+/* for every (keyword, label) pair within the threshold, keyword by keyword and, for each keyword, in label order - the order        */
+/* typosee prints.                                                                                                                   */
+/*                                                                                                                                   */
+/* Build:  cc -O2 -c libtyposee.c && ar rcs libtyposee.a libtyposee.o       (or: cc -O2 -fPIC -shared -o libtyposee.so libtyposee.c) */
+/*         the tool itself: cc -O2 -pthread -o typosee typosee.c libtyposee.c                                                        */
+/*************************************************************************************************************************************/
+
+#ifndef TYPOSEE_H
+#define TYPOSEE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+typedef enum {
+    INSERTION,
+    DELETION,
+    SUBSTITUTION,
+    TRANSPOSITION,                      /* arg1 arg2 at pos and pos + 1 swapped */
+    NONE
+} edit_type;
+
+struct edit {
+    unsigned int score;
+    edit_type type;
+    char arg1;
+    char arg2;
+    unsigned int pos;
+    struct edit *prev;
+};
+
+typedef struct edit edit;
+
+/*
+ * Reference implementation: returns the distance between str1 and str2 and points
+ * *script at a malloc()ed array of that many edits, which the caller frees.
+ */
+unsigned int levenshtein_distance(const char *str1, const char *str2, edit **script);
+
+/* Same, with a swap of two adjacent characters one edit (optimal string alignment) */
+unsigned int osa_distance(const char *str1, const char *str2, edit **script);
+
+/*
+ * Edit costs, for weighting some edits below others: a key next to the right one, "0"
+ * for "o". They are whole TYPOSEE_COST_UNITs (tenths of an edit) from 0 to 255, and
+ * every edit costs one edit, TYPOSEE_COST_UNIT, until a rule says otherwise. A cost
+ * file has one rule per line, applied in order, '#' starting a comment:
+ *
+ *     sub a b 0.5          substituting b for a or a for b
+ *     ins - 0.5            inserting '-' (del c: deleting c)
+ *     sub * 1.5            every substitution, insertion or deletion ("ins *", "del *"),
+ *                          which includes those of code points past 0xff
+ *     swap 0.8             a transposition, when they are on
+ *     keyboard 0.5         substituting keys next to each other on a QWERTY keyboard
+ */
+#define TYPOSEE_COST_UNIT       10
+
+typedef struct typosee_costs typosee_costs;
+
+typosee_costs *typosee_costs_parse(const char *text, size_t len);  /* NULL if malformed or out of memory */
+typosee_costs *typosee_costs_load(const char *path);                /* NULL if unreadable too */
+void typosee_costs_free(typosee_costs *costs);
+
+/*
+ * Weighted distance of str1 to str2 by the same matrix: its cost in units, with
+ * *script pointing at *edits edits as levenshtein_distance() does.
+ */
+unsigned int weighted_distance(const char *str1, const char *str2, const typosee_costs *costs, int osa,
+        edit **script, unsigned int *edits);
+
+/* A keyword list compiled for matching; read-only once built, so threads can share it */
+typedef struct typosee_set typosee_set;
+
+/* Per-thread scratch memory the matcher reuses from call to call */
+typedef struct typosee_workspace typosee_workspace;
+
+/*
+ * Labels in structure-of-arrays form: the text of label i is arena + off[i], len[i]
+ * bytes plus a NUL, and line[i] is whatever the caller wants to know it by (typosee
+ * uses the index of the subdomain it was cut from). Punycode labels ("xn--...") are
+ * decoded as they are added and listed in idn[], with their code points at
+ * cp + idn_off[i], idn_len[i] of them; they are matched code point by code point.
+ * Every label is hashed as it is added (hash[i], FNV-1a of its bytes), and sealing
+ * uses that to fold repeats: order[] gets one index per distinct text among the other
+ * labels, nunique of them sorted by length, which is the order the byte kernels take
+ * them in, and same[] chains each to the later labels with its text, which take its
+ * distance rather than a pass of their own. upto[i] is how many labels order[0..i)
+ * stand for, repeats included.
+ */
+typedef struct typosee_batch {
+    char *arena;
+    size_t arena_len;
+    size_t arena_cap;
+    uint32_t *off;
+    uint32_t *len;
+    uint32_t *line;
+    uint32_t *order;
+    size_t nunique;
+    uint64_t *hash;
+    uint32_t *same;                     /* UINT32_MAX after the last, and for punycode labels */
+    uint32_t *upto;
+    size_t n;
+    size_t cap;
+    uint32_t *idn;
+    uint32_t *idn_off;
+    uint32_t *idn_len;
+    size_t nidn;
+    size_t idn_cap;
+    uint32_t *cp;
+    size_t cp_len;
+    size_t cp_cap;
+    int sealed;
+} typosee_batch;
+
+void typosee_batch_init(typosee_batch *b);
+int typosee_batch_add(typosee_batch *b, const char *label, size_t len, uint32_t line);  /* -1 if out of memory */
+int typosee_batch_seal(typosee_batch *b);                                               /* -1 if out of memory */
+void typosee_batch_clear(typosee_batch *b);     /* empty it, keeping the memory */
+void typosee_batch_free(typosee_batch *b);
+
+typedef struct typosee_match {
+    unsigned int keyword;               /* index into the set */
+    size_t label;                       /* index into the batch */
+    unsigned int distance;              /* edits, or their cost with edit costs; 0 for a homoglyph */
+    size_t offset;                      /* the part of the label matched: all of it, except in substring */
+    size_t length;                      /* mode (code points rather than bytes for a punycode label) */
+    const edit *script;                 /* `edits` edits turning the keyword into that part, or NULL
+                                           when either string is empty, the label is punycode (edits
+                                           hold bytes) or the workspace has scripts turned off; valid
+                                           only during the callback */
+    unsigned int edits;                 /* 0 without a script */
+    int homoglyph;                      /* a different string with the keyword's skeleton */
+} typosee_match;
+
+/* Return non-zero to stop the batch early */
+typedef int (*typosee_match_cb)(const typosee_match *m, void *ctx);
+
+/*
+ * lens may be NULL for NUL-terminated keywords. Keywords are UTF-8 or punycode; their
+ * code points are what punycode labels are compared with. Returns NULL if out of memory.
+ */
+typosee_set *typosee_set_compile(const char *const *keywords, const size_t *lens, unsigned int n);
+void typosee_set_free(typosee_set *set);
+unsigned int typosee_set_count(const typosee_set *set);
+
+/*
+ * Gives keyword k a threshold of its own, for lists where "ebay" can take one edit
+ * and "microsoftonline" three. The match calls' threshold stays the ceiling: keyword
+ * k is matched under the lower of the two, and the lengths of label it looks at, the
+ * band and the exact-hit shortcut all follow from that bound, so a loose keyword costs
+ * the strict ones nothing. Set thresholds before the set is shared between threads.
+ * Returns -1 if out of memory.
+ */
+int typosee_set_threshold(typosee_set *set, unsigned int k, unsigned int threshold);
+const char *typosee_set_keyword(const typosee_set *set, unsigned int k);    /* NUL-terminated */
+size_t typosee_set_keyword_len(const typosee_set *set, unsigned int k);
+size_t typosee_set_footprint(const typosee_set *set);   /* bytes one pass over the set touches */
+
+typosee_workspace *typosee_workspace_new(void);
+void typosee_workspace_free(typosee_workspace *ws);
+
+/* Time spent in one stage of matching, summed over calls */
+typedef struct typosee_time {
+    uint64_t wall_ns;
+    uint64_t cpu_ns;                    /* CPU time of the calling thread */
+} typosee_time;
+
+/* What a workspace's matching has cost so far */
+typedef struct typosee_stats {
+    const char *isa;                    /* kernel variant, as typosee_isa() names it */
+    unsigned int lanes;                 /* labels the kernel runs side by side */
+    uint64_t kernel_pairs;              /* pairs through the bit-parallel kernel */
+    uint64_t kernel_steps;              /* vector steps it took */
+    uint64_t lane_steps;                /* lanes of those steps that carried a label */
+    uint64_t matrix_pairs;              /* pairs through a recurrence a column at a time (keywords over 64 bytes, edit costs) */
+    uint64_t idn_pairs;                 /* pairs compared on code points (punycode labels) */
+    uint64_t pairs;                     /* keyword x label pairs considered */
+    uint64_t length_rejects;            /* of those, ruled out by the difference in length alone */
+    uint64_t repeats;                   /* of those, labels that took an earlier copy's distance */
+    uint64_t triangle_skips;            /* of those, ruled out by a clustered keyword's distance to the label */
+    uint64_t exact_lookups;             /* labels looked up in the keywords' perfect hash */
+    uint64_t cells;                     /* DP cells computed, edit script matrices included */
+    uint64_t matches;
+    uint64_t homoglyphs;                /* of those, skeleton collisions */
+    typosee_time filter;                /* stage times, kept only while timing is on */
+    typosee_time distance;
+    typosee_time callback;
+} typosee_stats;
+
+void typosee_workspace_stats(const typosee_workspace *ws, typosee_stats *st);   /* adds to *st */
+
+/* Turns the stage clocks on or off; they cost a few clock reads per keyword and per match */
+void typosee_workspace_timing(typosee_workspace *ws, int on);
+
+/*
+ * Turns edit scripts on (the default) or off. With them off a match costs nothing
+ * beyond its distance; with them on it pays for a full matrix and its traceback.
+ */
+void typosee_workspace_scripts(typosee_workspace *ws, int on);
+
+/*
+ * Turns substring matching on or off (the default). With it on, a keyword's distance
+ * to a label is its distance to the closest substring of the label, found in one
+ * pass by the bit-parallel kernel run as an approximate search (Sellers' recurrence),
+ * so "paypal-secure-login" is at 0 from "paypal". Labels longer than the keyword are
+ * no longer ruled out by length; offset and length in the match say where it was found.
+ */
+void typosee_workspace_substring(typosee_workspace *ws, int on);
+
+/*
+ * Turns transpositions on or off (the default). With them on, distances are optimal
+ * string alignment ones: "paypla" is 1 from "paypal", not 2. The kernel takes them
+ * in the same pass (Hyyro's extension of Myers' algorithm), and edit scripts show
+ * them as TRANSPOSITION.
+ */
+void typosee_workspace_transpositions(typosee_workspace *ws, int on);
+
+/*
+ * Weights the edits by costs, which must outlive the workspace's use of them, or
+ * goes back to one per edit (NULL, the default). Thresholds and distances are then
+ * in TYPOSEE_COST_UNITs, and every pair takes the weighted column kernel instead of
+ * the bit-parallel one, or the banded scalar recurrence for keywords over 64 bytes
+ * and the portable build: either is abandoned as soon as a column or row is over
+ * the threshold, and the band is as wide as the threshold buys the cheapest
+ * insertions or deletions.
+ */
+void typosee_workspace_costs(typosee_workspace *ws, const typosee_costs *costs);
+
+/*
+ * Turns homoglyph matching on or off (the default). With it on, labels are mapped to
+ * a confusables skeleton (0 -> o, 1 -> l, rn -> m, vv -> w, cl -> d, Cyrillic, Greek,
+ * Armenian and fullwidth lookalikes to Latin) and looked up in a hash of the
+ * keywords' skeletons. A label that differs from a keyword but shares its skeleton,
+ * such as "paypa1" or a punycode "pаypal", is reported for it with homoglyph set,
+ * whatever the threshold, instead of as an edit-distance match.
+ */
+void typosee_workspace_homoglyphs(typosee_workspace *ws, int on);
+
+/*
+ * Reports only the k nearest pairs, or all of them again (k = 0, the default), with
+ * the threshold as a ceiling. TYPOSEE_TOP_KEYWORDS keeps, for each label of the batch,
+ * the k closest keywords of the block; TYPOSEE_TOP_LABELS keeps, for each keyword, the
+ * k closest labels of the batch, and once that keyword's heap is full its worst
+ * distance becomes the bound the rest of the batch is matched under, so the window of
+ * lengths and the band shrink as it fills. Ties go to the lower index. Homoglyph hits
+ * are reported as before, on top of the k.
+ */
+#define TYPOSEE_TOP_KEYWORDS    1
+#define TYPOSEE_TOP_LABELS      2
+
+void typosee_workspace_top(typosee_workspace *ws, int mode, unsigned int k);
+
+/*
+ * Holds keyword k of the set to bounds[k] as well, for callers that keep tightening
+ * keywords from one batch to the next, such as a top-k kept across batches: it is the
+ * bound a TYPOSEE_TOP_LABELS heap starts from. The array is read on every match call
+ * and may change between them; NULL (the default) drops it.
+ */
+void typosee_workspace_bounds(typosee_workspace *ws, const unsigned int *bounds);
+
+/*
+ * Kernel variant for workspaces made from now on: "avx512", "avx2", "sse4.1" or
+ * "scalar". By default it is $TYPOSEE_ISA if set and runnable here, otherwise the
+ * widest this CPU supports. typosee_set_isa() returns -1 if the name is unknown or
+ * the CPU lacks the instructions.
+ */
+int typosee_set_isa(const char *name);
+const char *typosee_isa(void);
+
+/*
+ * Public Suffix List, for telling the labels of a name that someone registered from
+ * the suffix ("co.uk", "s3.amazonaws.com") they registered them under. The file is
+ * either the list itself (public_suffix_list.dat), compiled on load, or an image
+ * written by typosee_psl_save(), which is mmapped as it is. Lookups take lower-case
+ * names.
+ */
+typedef struct typosee_psl typosee_psl;
+
+typosee_psl *typosee_psl_load(const char *path);        /* NULL if unreadable or out of memory */
+int typosee_psl_save(const typosee_psl *psl, const char *path);
+void typosee_psl_free(typosee_psl *psl);
+
+/* Length of the part of name in front of its public suffix: 11 for "mail.paypa1.co.uk", 0 for "co.uk" */
+size_t typosee_psl_prefix(const typosee_psl *psl, const char *name, size_t len);
+
+/*
+ * Clusters the keywords, for lists with runs of near-identical ones ("paypal",
+ * "paypal-login", "paypa1"): each keyword within radius edits of an earlier one is
+ * anchored on it, with the distance between the two kept. When a keyword and its
+ * anchor fall in the same block, the anchor's distance to each label is kept as the
+ * block goes by, and the keyword skips every label where the two distances differ by
+ * more than its threshold, since the label can't be any closer to it than that. The
+ * skips count in typosee_stats as triangle_skips. Only plain edit distance obeys the
+ * triangle inequality, so workspaces with transpositions, edit costs or substring
+ * matching on go without. Returns how many keywords were anchored, or -1 if out of
+ * memory; like thresholds, clusters go in before the set is shared between threads.
+ */
+int typosee_set_clusters(typosee_set *set, unsigned int radius);
+
+/*
+ * Matches every keyword of the set against every label of a sealed batch and calls cb
+ * for each pair at distance <= threshold, or the keyword's own threshold if that is
+ * lower. Outside substring mode, a threshold below the cheapest edit (0 without edit
+ * costs) asks for exact hits only, which skip the distance kernels: each distinct
+ * label is looked up in a minimal perfect hash of the keywords, one probe and one
+ * compare, by the hash the batch took as it was added. Returns 0, the callback's
+ * non-zero value if it stopped the batch, or -1 if out of memory.
+ */
+int typosee_match_batch(const typosee_set *set, typosee_workspace *ws, const typosee_batch *batch,
+        unsigned int threshold, typosee_match_cb cb, void *ctx);
+
+/* Same, restricted to keywords [kw_first, kw_first + kw_count) of the set */
+int typosee_match_block(const typosee_set *set, unsigned int kw_first, unsigned int kw_count,
+        typosee_workspace *ws, const typosee_batch *batch,
+        unsigned int threshold, typosee_match_cb cb, void *ctx);
+
+#endif
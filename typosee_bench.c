@@ -0,0 +1,653 @@
+/***************************/
+/* typosee_bench.c         */
+/*                         ***********************************************************************************************************/
+/* Microbenchmark for the distance kernels: levenshtein_distance(), the reference implementation, and libtyposee's batch matcher in  */
+/* every kernel variant this CPU can run (typosee_isa() names them), over a grid of keyword lengths, label lengths and thresholds.   */
+/*                                                                                                                                   */
+/* Each grid point matches one random keyword against a batch of labels of one length, --typos percent of them a few edits away      */
+/* from the keyword and the rest random, after a warm-up pass, and keeps the fastest of --reps repetitions. Matches cost a full      */
+/* matrix for their edit script, so the share of pairs that matched is reported alongside nanoseconds per (keyword, label) pair,     */
+/* DP cells (keyword length x label length) per nanosecond, and cycles per pair from the time-stamp counter where there is one.      */
+/* Everything is generated from --seed, so runs are repeatable and need no input files.                                              */
+/*                                                                                                                                   */
+/* --verify N instead checks the batch matcher against levenshtein_distance() on N random cases: every kernel variant, with and      */
+/* without edit scripts, whole-label and substring matching, plain and with transpositions (against osa_distance()), with and        */
+/* without a table of edit costs (against weighted_distance()), at thresholds from 0 up to past the longest string, the call's or    */
+/* one the keyword was given, with the keyword alone in its set or anchored on one of the labels for the triangle inequality to      */
+/* prune by, on random, typo, swapped, identical, all-different, non-ASCII and empty strings and on lengths either side of the       */
+/* 64-character word. The matches must be exactly the pairs the reference puts within the threshold, in label order, with the        */
+/* reference's distance and edit script, or with the k closest labels asked for, exactly the first k of them by distance and index;  */
+/* in substring mode the reference is Sellers' recurrence, and the part of the label reported must be at that distance. It prints    */
+/* the first mismatches and exits non-zero if there are any, so it can gate a build:  ./typosee_bench --verify 2000                  */
+/*                                                                                                                                   */
+/* Build and run:  cc -O2 -o typosee_bench typosee_bench.c libtyposee.c && ./typosee_bench --csv bench.csv                           */
+/*************************************************************************************************************************************/
+
+#define _GNU_SOURCE
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <time.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+#include "typosee.h"
+
+#define LABELS          4096            /* labels per batch */
+#define REF_LABELS      256             /* levenshtein_distance() allocates per pair; fewer is plenty */
+#define VERIFY_LABELS   64              /* labels per --verify case */
+#define VERIFY_LEN      130             /* longest --verify string, well past the 64-character kernel */
+
+static const unsigned int kw_lens[] = { 3, 7, 15, 31, 63 };
+static const int label_deltas[] = { -2, -1, 0, 1, 2 };
+static const char *const isas[] = { "scalar", "sse4.1", "avx2", "avx512" };
+
+#define NELEMS(a)       (sizeof(a) / sizeof((a)[0]))
+
+struct result {
+    double match_pct;
+    double ns_pair;
+    double cells_ns;
+    double cycles_pair;
+};
+
+static void die(const char *msg)
+{
+    fprintf(stderr, "[ERR]: %s\n", msg);
+    exit(1);
+}
+
+static unsigned long long now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (unsigned long long)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static unsigned long long cycles(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    return 0;
+#endif
+}
+
+/* xorshift64*, so the same seed gives the same grid everywhere */
+static uint64_t rng_state;
+
+static uint64_t rng(void)
+{
+    rng_state ^= rng_state >> 12;
+    rng_state ^= rng_state << 25;
+    rng_state ^= rng_state >> 27;
+    return rng_state * 0x2545f4914f6cdd1dull;
+}
+
+static char random_char(void)
+{
+    static const char alphabet[] = "abcdefghijklmnopqrstuvwxyz0123456789-";
+
+    return alphabet[rng() % (sizeof(alphabet) - 1)];
+}
+
+/* A label of exactly len bytes: a few random edits away from the keyword, or random */
+static void make_label(char *out, size_t len, const char *kw, size_t kw_len, unsigned int typo_pct)
+{
+    size_t i, edits;
+
+    if (rng() % 100 < typo_pct) {
+        for (i = 0; i < len; i++) {
+            out[i] = i < kw_len ? kw[i] : random_char();
+        }
+        for (edits = rng() % 4; edits > 0; edits--) {
+            out[rng() % len] = random_char();
+        }
+    }
+    else {
+        for (i = 0; i < len; i++) {
+            out[i] = random_char();
+        }
+    }
+    out[len] = 0x0;
+}
+
+static int count_match(const typosee_match *m, void *ctx)
+{
+    (void)m;
+    (*(unsigned long *)ctx)++;
+    return 0;
+}
+
+static void finish(struct result *r, unsigned long long ns, unsigned long long cyc,
+        unsigned long pairs, unsigned long matches, size_t kw_len, size_t label_len)
+{
+    r->match_pct = 100.0 * matches / pairs;
+    r->ns_pair = (double)ns / pairs;
+    r->cells_ns = r->ns_pair > 0 ? kw_len * label_len / r->ns_pair : 0.0;
+    r->cycles_pair = (double)cyc / pairs;
+}
+
+static void bench_reference(struct result *r, const char *kw, size_t kw_len, char labels[][128],
+        size_t label_len, unsigned int reps, int osa)
+{
+    unsigned long long t0, c0, best = ~0ull, best_cyc = 0;
+    unsigned int rep, i;
+    edit *script;
+
+    for (rep = 0; rep <= reps; rep++) {         /* rep 0 is the warm-up */
+        t0 = now_ns();
+        c0 = cycles();
+        for (i = 0; i < REF_LABELS; i++) {
+            script = NULL;
+            (osa ? osa_distance : levenshtein_distance)(kw, labels[i], &script);
+            free(script);
+        }
+        if (rep && now_ns() - t0 < best) {
+            best = now_ns() - t0;
+            best_cyc = cycles() - c0;
+        }
+    }
+    finish(r, best, best_cyc, REF_LABELS, REF_LABELS, kw_len, label_len);
+}
+
+static void bench_batch(struct result *r, const typosee_set *set, const typosee_batch *batch,
+        size_t kw_len, size_t label_len, unsigned int threshold, unsigned int reps, int osa)
+{
+    typosee_workspace *ws = typosee_workspace_new();
+    unsigned long long t0, c0, best = ~0ull, best_cyc = 0;
+    unsigned long matches;
+    unsigned int rep;
+
+    if (ws == NULL) {
+        die("Out of memory");
+    }
+    typosee_workspace_transpositions(ws, osa);
+    for (rep = 0; rep <= reps; rep++) {
+        matches = 0;
+        t0 = now_ns();
+        c0 = cycles();
+        if (typosee_match_batch(set, ws, batch, threshold, count_match, &matches) < 0) {
+            die("Out of memory");
+        }
+        if (rep && now_ns() - t0 < best) {
+            best = now_ns() - t0;
+            best_cyc = cycles() - c0;
+        }
+    }
+    typosee_workspace_free(ws);
+    finish(r, best, best_cyc, batch->n, matches, kw_len, label_len);
+}
+
+/* What the reference says about every label of a --verify case, and what the matcher has said so far */
+struct verify {
+    const char *kernel;
+    const char *kw;
+    char (*labels)[VERIFY_LEN + 1];
+    unsigned int *dist;                 /* whole-label distances, or closest-substring ones */
+    edit **script;
+    unsigned int *edits;                /* script lengths, when they differ from the distance */
+    unsigned int threshold;
+    int scripts;
+    int substring;
+    int osa;
+    int weighted;
+    const unsigned char *keep;          /* top-k: the labels among the k closest, NULL for all */
+    unsigned int keyword;               /* the one under test; the set may hold its anchor too */
+    size_t next;                        /* labels before this one are accounted for */
+    unsigned long mismatches;
+};
+
+static void mismatch(struct verify *v, size_t label, const char *what)
+{
+    static unsigned int printed;
+
+    v->mismatches++;
+    if (printed++ < 10) {
+        fprintf(stderr, "[VERIFY] %s%s%s%s, threshold %u: keyword [%s], label %zu [%s] (reference distance %u): %s\n",
+            v->kernel, v->substring ? " substring" : "", v->osa ? " osa" : "", v->weighted ? " weighted" : "",
+            v->threshold, v->kw, label,
+            v->labels[label], v->dist[label], what);
+    }
+}
+
+/* Labels skipped since the last match must all be beyond the threshold */
+static void verify_skipped(struct verify *v, size_t upto)
+{
+    for (; v->next < upto; v->next++) {
+        if (v->dist[v->next] <= v->threshold && (!v->keep || v->keep[v->next])) {
+            mismatch(v, v->next, "missed");
+        }
+    }
+}
+
+static int verify_match(const typosee_match *m, void *ctx)
+{
+    struct verify *v = ctx;
+    const char *label = v->labels[m->label];
+    char sub[VERIFY_LEN + 1];
+    edit *found = NULL;
+    const edit *ref = v->script[m->label];
+    unsigned int i, edits = v->edits ? v->edits[m->label] : m->distance;
+
+    if (m->keyword != v->keyword) {
+        return 0;
+    }
+    if (m->label < v->next) {
+        mismatch(v, m->label, "reported out of label order");
+        return 0;
+    }
+    verify_skipped(v, m->label);
+    v->next = m->label + 1;
+    if (v->substring) {
+        /* the part reported must be at the distance reported, and scripts are against it */
+        if (m->offset + m->length > strlen(label)) {
+            mismatch(v, m->label, "substring out of the label");
+            return 0;
+        }
+        memcpy(sub, label + m->offset, m->length);
+        sub[m->length] = 0x0;
+        if ((v->osa ? osa_distance(v->kw, sub, &found) : levenshtein_distance(v->kw, sub, &found)) != m->distance) {
+            mismatch(v, m->label, "substring not at the distance reported");
+        }
+        ref = found;
+        label = sub;
+    }
+    if (m->distance != v->dist[m->label]) {
+        mismatch(v, m->label, "wrong distance");
+    }
+    else if (m->distance > v->threshold) {
+        mismatch(v, m->label, "reported beyond the threshold");
+    }
+    else if (v->keep && !v->keep[m->label]) {
+        mismatch(v, m->label, "not among the k closest");
+    }
+    else if (!v->scripts && m->script) {
+        mismatch(v, m->label, "edit script with scripts turned off");
+    }
+    else if (v->scripts && edits && (m->script != NULL) != (*v->kw && *label)) {
+        /* the reference has no script when either string is empty either */
+        mismatch(v, m->label, m->script ? "edit script where none was expected" : "no edit script");
+    }
+    else if (m->script && m->edits != edits) {
+        mismatch(v, m->label, "edit script of a different length");
+    }
+    else {
+        for (i = 0; m->script && i < edits; i++) {
+            if (m->script[i].type != ref[i].type || m->script[i].arg1 != ref[i].arg1
+                    || m->script[i].arg2 != ref[i].arg2 || m->script[i].pos != ref[i].pos
+                    || m->script[i].score != ref[i].score) {
+                mismatch(v, m->label, "different edit script");
+                break;
+            }
+        }
+    }
+    free(found);
+    return 0;
+}
+
+/* Distance of kw to the closest substring of label, by the plain Sellers recurrence (with transpositions if osa) */
+static unsigned int substring_distance(const char *kw, const char *label, int osa)
+{
+    unsigned int col[3][VERIFY_LEN + 1], d, best;
+    size_t m = strlen(kw), i, j;
+    unsigned int *prev2 = col[0], *prev = col[1], *cur = col[2], *tmp;
+
+    for (i = 0; i <= m; i++) {
+        prev[i] = i;
+    }
+    for (best = m, j = 0; label[j]; j++) {
+        cur[0] = 0;
+        for (i = 1; i <= m; i++) {
+            d = prev[i - 1] + (kw[i - 1] != label[j]);
+            d = prev[i] + 1 < d ? prev[i] + 1 : d;
+            d = cur[i - 1] + 1 < d ? cur[i - 1] + 1 : d;
+            if (osa && i > 1 && j > 0 && kw[i - 1] == label[j - 1] && kw[i - 2] == label[j]) {
+                d = prev2[i - 2] + 1 < d ? prev2[i - 2] + 1 : d;
+            }
+            cur[i] = d;
+        }
+        best = cur[m] < best ? cur[m] : best;
+        tmp = prev2;
+        prev2 = prev;
+        prev = cur;
+        cur = tmp;
+    }
+    return best;
+}
+
+/* Lengths either side of the kernel's 64-character limit, and the ends of the range */
+static const unsigned int verify_lens[] = { 0, 1, 2, 3, 8, 31, 32, 33, 62, 63, 64, 65, 66, 100, VERIFY_LEN };
+
+static size_t verify_len(void)
+{
+    return rng() % 2 ? verify_lens[rng() % NELEMS(verify_lens)] : rng() % 80;
+}
+
+/* A verification label of one of several kinds, derived from the keyword */
+static size_t verify_label(char *out, const char *kw, size_t kw_len)
+{
+    size_t i, len = rng() % 4 ? (kw_len + rng() % 7 > 3 ? kw_len + rng() % 7 - 3 : 0) : verify_len();
+    unsigned int kind = rng() % 7;
+    char c;
+
+    if (len > VERIFY_LEN) {
+        len = VERIFY_LEN;
+    }
+    switch (kind) {
+    case 0:                             /* identical */
+        memcpy(out, kw, kw_len + 1);
+        return kw_len;
+    case 1:                             /* a few edits away */
+        for (i = 0; i < len; i++) {
+            out[i] = i < kw_len ? kw[i] : random_char();
+        }
+        for (i = rng() % 4; i > 0 && len; i--) {
+            out[rng() % len] = random_char();
+        }
+        break;
+    case 2:                             /* nothing in common with a lower-case keyword */
+        for (i = 0; i < len; i++) {
+            out[i] = 'A' + rng() % 26;
+        }
+        break;
+    case 3:                             /* bytes above 0x7f */
+        for (i = 0; i < len; i++) {
+            out[i] = (char)(0x80 + rng() % 0x80);
+        }
+        break;
+    case 4:                             /* a tiny alphabet, so many near-ties in the matrix */
+        for (i = 0; i < len; i++) {
+            out[i] = 'a' + rng() % 2;
+        }
+        break;
+    case 5:                             /* neighbours swapped, the transposition kernels' business */
+        memcpy(out, kw, kw_len + 1);
+        for (i = 1 + rng() % 3; i > 0 && kw_len > 1; i--) {
+            len = rng() % (kw_len - 1);
+            c = out[len];
+            out[len] = out[len + 1];
+            out[len + 1] = c;
+        }
+        return kw_len;
+    default:
+        for (i = 0; i < len; i++) {
+            out[i] = random_char();
+        }
+        break;
+    }
+    if (len > 4 && !memcmp(out, "xn--", 4)) {
+        out[0] = 'y';                   /* punycode labels are matched on code points, not against the reference */
+    }
+    out[len] = 0x0;
+    return len;
+}
+
+/* Returns the number of mismatches over `cases` random keywords, each against a batch of labels */
+static unsigned long verify(unsigned int cases, unsigned int *checked_pairs)
+{
+    static char labels[VERIFY_LABELS][VERIFY_LEN + 1];
+    static unsigned int dist[2][VERIFY_LABELS], sub_dist[2][VERIFY_LABELS], w_dist[2][VERIFY_LABELS], w_edits[2][VERIFY_LABELS];
+    static edit *script[2][VERIFY_LABELS], *w_script[2][VERIFY_LABELS];
+    static unsigned char keep[VERIFY_LABELS];
+    /* Cheap, dear and free edits, including the ones rules leave at a unit */
+    static const char cost_rules[] = "sub * 1.3\nins * 0.9\ndel * 1.1\nsub a b 0.3\nsub c 0 0\nins - 0.4\ndel d 0.6\n"
+                                     "swap 0.7\nkeyboard 0.8\nsub q w 2.5\n";
+    typosee_costs *costs = typosee_costs_parse(cost_rules, sizeof(cost_rules) - 1);
+    char kw[VERIFY_LEN + 1];
+    const char *kwp = kw, *pair[2];
+    const unsigned int thresholds[] = { 0, 1, 2, 3, 5, 9, 2 * VERIFY_LEN };
+    struct verify v;
+    typosee_workspace *ws;
+    typosee_batch batch;
+    typosee_set *set, *clustered, *use;
+    size_t i, j, n, len, kw_len;
+    unsigned int c, t, k, top, own, call, bounds[2];
+    unsigned long mismatches = 0;
+
+    if (costs == NULL) {
+        die("Unable to parse the verification edit costs");
+    }
+    typosee_batch_init(&batch);
+    for (c = 0; c < cases; c++) {
+        kw_len = verify_len();
+        for (i = 0; i < kw_len; i++) {
+            kw[i] = rng() % 8 ? (char)('a' + rng() % 4) : (char)(0x80 + rng() % 0x80);
+        }
+        kw[kw_len] = 0x0;
+        if ((set = typosee_set_compile(&kwp, NULL, 1)) == NULL) {
+            die("Out of memory");
+        }
+        n = 1 + rng() % VERIFY_LABELS;
+        typosee_batch_clear(&batch);
+        for (i = 0; i < n; i++) {
+            len = verify_label(labels[i], kw, kw_len);
+            script[0][i] = script[1][i] = w_script[0][i] = w_script[1][i] = NULL;
+            dist[0][i] = levenshtein_distance(kw, labels[i], &script[0][i]);
+            dist[1][i] = osa_distance(kw, labels[i], &script[1][i]);
+            w_dist[0][i] = weighted_distance(kw, labels[i], costs, 0, &w_script[0][i], &w_edits[0][i]);
+            w_dist[1][i] = weighted_distance(kw, labels[i], costs, 1, &w_script[1][i], &w_edits[1][i]);
+            sub_dist[0][i] = substring_distance(kw, labels[i], 0);
+            sub_dist[1][i] = substring_distance(kw, labels[i], 1);
+            if (typosee_batch_add(&batch, labels[i], len, i) < 0) {
+                die("Out of memory");
+            }
+        }
+        if (typosee_batch_seal(&batch) < 0) {
+            die("Out of memory");
+        }
+        /* The keyword again, anchored on one of the labels, so the triangle inequality gets to prune */
+        pair[0] = labels[rng() % n];
+        pair[1] = kw;
+        if ((clustered = typosee_set_compile(pair, NULL, 2)) == NULL || typosee_set_clusters(clustered, 2 * VERIFY_LEN) < 0) {
+            die("Out of memory");
+        }
+
+        for (k = 0; k < NELEMS(isas); k++) {
+            if (typosee_set_isa(isas[k]) < 0) {
+                continue;
+            }
+            if ((ws = typosee_workspace_new()) == NULL) {
+                die("Out of memory");
+            }
+            for (t = 0; t < 6 * NELEMS(thresholds); t++) {
+                memset(&v, 0, sizeof(v));
+                v.scripts = t % 2 == 0;
+                v.substring = t / 2 % 3 == 1;
+                v.weighted = t / 2 % 3 == 2;    /* whole labels only: the reference has no weighted search */
+                v.osa = (t / 6 + c) % 2;        /* every other case, so the run takes no longer */
+                typosee_workspace_scripts(ws, v.scripts);
+                typosee_workspace_substring(ws, v.substring);
+                typosee_workspace_transpositions(ws, v.osa);
+                typosee_workspace_costs(ws, v.weighted ? costs : NULL);
+                v.kernel = typosee_isa();
+                v.kw = kw;
+                v.labels = labels;
+                v.dist = v.weighted ? w_dist[v.osa] : v.substring ? sub_dist[v.osa] : dist[v.osa];
+                v.script = v.weighted ? w_script[v.osa] : script[v.osa];
+                v.edits = v.weighted ? w_edits[v.osa] : NULL;
+                /* thresholds that fall between whole edits as well as on them */
+                v.threshold = v.weighted ? thresholds[t / 6] * 7 : thresholds[t / 6];
+                /* and every other case a keyword threshold of its own, which wins when it is lower */
+                own = c % 2 ? thresholds[(t / 6 + c / 2) % NELEMS(thresholds)] * (v.weighted ? 7 : 1) : UINT32_MAX;
+                v.keyword = (t + c / 2) % 2;
+                use = v.keyword ? clustered : set;
+                if (typosee_set_threshold(use, v.keyword, own) < 0) {
+                    die("Out of memory");
+                }
+                /* every third case a bound for this call as well, as a top-k kept across batches passes */
+                bounds[0] = bounds[1] = UINT32_MAX;
+                bounds[v.keyword] = c % 3 == 1 ? thresholds[(t / 6 + c) % NELEMS(thresholds)] * (v.weighted ? 7 : 1) : UINT32_MAX;
+                typosee_workspace_bounds(ws, bounds);
+                call = v.threshold;
+                v.threshold = own < v.threshold ? own : v.threshold;
+                v.threshold = bounds[v.keyword] < v.threshold ? bounds[v.keyword] : v.threshold;
+                /* every third run only the closest few labels, ties to the lower index */
+                top = (t + c) % 3 ? 0 : 1 + c % 4;
+                typosee_workspace_top(ws, TYPOSEE_TOP_LABELS, top);
+                if (top) {
+                    for (i = 0; i < n; i++) {
+                        for (j = 0, len = 0; j < n; j++) {
+                            len += v.dist[j] < v.dist[i] || (v.dist[j] == v.dist[i] && j < i);
+                        }
+                        keep[i] = len < top;
+                    }
+                    v.keep = keep;
+                }
+                if (typosee_match_batch(use, ws, &batch, call, verify_match, &v) < 0) {
+                    die("Out of memory");
+                }
+                verify_skipped(&v, n);
+                mismatches += v.mismatches;
+                *checked_pairs += n;
+            }
+            typosee_workspace_free(ws);
+        }
+
+        for (i = 0; i < n; i++) {
+            free(script[0][i]);
+            free(script[1][i]);
+            free(w_script[0][i]);
+            free(w_script[1][i]);
+        }
+        typosee_set_free(set);
+        typosee_set_free(clustered);
+    }
+    typosee_batch_free(&batch);
+    typosee_costs_free(costs);
+    return mismatches;
+}
+
+static void report(FILE *csv, const char *kernel, size_t kw_len, size_t label_len, const char *threshold,
+        const struct result *r)
+{
+    printf("%-8s %6zu %6zu %9s %7.1f %10.2f %10.3f %12.1f\n", kernel, kw_len, label_len, threshold,
+        r->match_pct, r->ns_pair, r->cells_ns, r->cycles_pair);
+    if (csv) {
+        fprintf(csv, "%s,%zu,%zu,%s,%.2f,%.3f,%.4f,%.1f\n", kernel, kw_len, label_len, threshold,
+            r->match_pct, r->ns_pair, r->cells_ns, r->cycles_pair);
+    }
+    fflush(stdout);
+}
+
+int main(int argc, char **argv)
+{
+    static char labels[LABELS][128];
+    char kw[128], thr[8];
+    const char *kwp;
+    const char *csv_name = NULL;
+    FILE *csv = NULL;
+    unsigned int reps = 5, max_threshold = 5, typo_pct = 5, verify_cases = 0, checked = 0, threshold, i, k, d, v;
+    unsigned long mismatches;
+    unsigned long long seed = 1;
+    typosee_set *set;
+    typosee_batch batch;
+    struct result r;
+    size_t kw_len, label_len;
+    int len, osa = 0;
+
+    for (i = 1; i < (unsigned int)argc; i++) {
+        if (!strcmp(argv[i], "--csv") && i + 1 < (unsigned int)argc) {
+            csv_name = argv[++i];
+        }
+        else if (!strcmp(argv[i], "--reps") && i + 1 < (unsigned int)argc) {
+            reps = atoi(argv[++i]);
+        }
+        else if (!strcmp(argv[i], "--seed") && i + 1 < (unsigned int)argc) {
+            seed = strtoull(argv[++i], NULL, 10);
+        }
+        else if (!strcmp(argv[i], "--max-threshold") && i + 1 < (unsigned int)argc) {
+            max_threshold = atoi(argv[++i]);
+        }
+        else if (!strcmp(argv[i], "--typos") && i + 1 < (unsigned int)argc) {
+            typo_pct = atoi(argv[++i]);
+        }
+        else if (!strcmp(argv[i], "--osa")) {
+            osa = 1;
+        }
+        else if (!strcmp(argv[i], "--verify") && i + 1 < (unsigned int)argc) {
+            verify_cases = atoi(argv[++i]);
+        }
+        else {
+            printf("\ntyposee_bench - time the typosee distance kernels.\n\n\t");
+            printf("args: [--csv file] [--reps N] [--seed S] [--max-threshold T] [--typos P] [--osa]  or  [--seed S] --verify C\n\t"
+                   "where file also gets the results as CSV, N=timed repetitions (default 5), T=largest threshold (default 5),\n\t"
+                   "P=percentage of labels that are typos of the keyword (default 5), --osa times the transposition-aware kernels,\n\t"
+                   "C=random cases to check against the reference\n\n");
+            return 0;
+        }
+    }
+    if (verify_cases) {
+        rng_state = seed ? seed : 1;
+        mismatches = verify(verify_cases, &checked);
+        printf("[VERIFY] %u cases, %u (keyword, label, threshold) checks across the kernels: %lu mismatches\n",
+            verify_cases, checked, mismatches);
+        return mismatches ? 1 : 0;
+    }
+    if (reps < 1) {
+        die("--reps must be at least 1");
+    }
+    if (csv_name && (csv = fopen(csv_name, "w")) == NULL) {
+        die("unable to open the CSV file");
+    }
+    if (csv) {
+        fprintf(csv, "kernel,keyword_len,label_len,threshold,match_pct,ns_per_pair,cells_per_ns,cycles_per_pair\n");
+    }
+    printf("%-8s %6s %6s %9s %7s %10s %10s %12s\n", "kernel", "kwlen", "lblen", "threshold", "match%",
+        "ns/pair", "cells/ns", "cycles/pair");
+
+    rng_state = seed ? seed : 1;
+    typosee_batch_init(&batch);
+    for (k = 0; k < NELEMS(kw_lens); k++) {
+        kw_len = kw_lens[k];
+        for (i = 0; i < kw_len; i++) {
+            kw[i] = random_char();
+        }
+        kw[kw_len] = 0x0;
+        kwp = kw;
+        if ((set = typosee_set_compile(&kwp, NULL, 1)) == NULL) {
+            die("Out of memory");
+        }
+
+        for (d = 0; d < NELEMS(label_deltas); d++) {
+            len = (int)kw_len + label_deltas[d];
+            if (len < 1) {
+                continue;
+            }
+            label_len = len;
+            typosee_batch_clear(&batch);
+            for (i = 0; i < LABELS; i++) {
+                make_label(labels[i], label_len, kw, kw_len, typo_pct);
+                if (typosee_batch_add(&batch, labels[i], label_len, i) < 0) {
+                    die("Out of memory");
+                }
+            }
+            if (typosee_batch_seal(&batch) < 0) {
+                die("Out of memory");
+            }
+
+            bench_reference(&r, kw, kw_len, labels, label_len, reps, osa);
+            report(csv, "ref", kw_len, label_len, "-", &r);
+
+            for (v = 0; v < NELEMS(isas); v++) {
+                if (typosee_set_isa(isas[v]) < 0) {
+                    continue;           /* not on this CPU */
+                }
+                for (threshold = 0; threshold <= max_threshold; threshold++) {
+                    bench_batch(&r, set, &batch, kw_len, label_len, threshold, reps, osa);
+                    snprintf(thr, sizeof(thr), "%u", threshold);
+                    report(csv, typosee_isa(), kw_len, label_len, thr, &r);
+                }
+            }
+        }
+        typosee_set_free(set);
+    }
+
+    typosee_batch_free(&batch);
+    if (csv) {
+        fclose(csv);
+    }
+    return 0;
+}
@@ -0,0 +1,309 @@
+/***************************/
+/* typosee_gen.c           */
+/*                         ***********************************************************************************************************/
+/* Writes a synthetic WHOIS subdomain feed in the format typosee reads - a header line, then rows such as `4,4,4,abc.com` with the   */
+/* FQDN in the last column - so the whole tool can be benchmarked end to end without real data.                                      */
+/*                                                                                                                                   */
+/* Every FQDN is --depth subdomain labels, a registered domain label and a TLD. Label lengths are uniform over --label-len MIN-MAX,  */
+/* or geometric with the given mean when written MIN-MAX,MEAN, which is closer to what real feeds look like. --dups percent of the   */
+/* rows repeat one of the last few thousand FQDNs, and with --keywords, --typos percent of the rows carry a label one or two edits   */
+/* away from a random keyword, so the matcher has something to find. Output stops after --lines rows or --size bytes (K, M, G and    */
+/* T suffixes), whichever comes first; everything derives from --seed, so the same arguments always give the same file.              */
+/*                                                                                                                                   */
+/* End to end:  ./typosee_gen --size 1G --keywords keywords.txt > feed.csv                                                           */
+/*              ./typosee feed.csv keywords.txt 2 q -j 8 --stats > /dev/null      (the last [STATS] line has MB/s and lines/s)       */
+/*                                                                                                                                   */
+/* Build:  cc -O2 -o typosee_gen typosee_gen.c                                                                                       */
+/*************************************************************************************************************************************/
+
+#define _GNU_SOURCE
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <ctype.h>
+
+#define FQDN_MAX        253             /* longest name DNS allows */
+#define LABEL_MAX       63
+#define RECENT          4096            /* FQDNs remembered for --dups */
+#define OUT_BUF         (1024 * 1024)
+
+static const char *const tlds[] = {
+    "com", "com", "com", "com", "net", "org", "io", "info", "de", "co.uk", "ru", "xyz", "online", "com.br", "app"
+};
+
+#define NELEMS(a)       (sizeof(a) / sizeof((a)[0]))
+
+struct range {
+    unsigned int min;
+    unsigned int max;
+    unsigned int mean;                  /* 0: uniform */
+};
+
+static void die(const char *msg)
+{
+    fprintf(stderr, "[ERR]: %s\n", msg);
+    exit(1);
+}
+
+/* xorshift64*, so the same seed gives the same feed everywhere */
+static uint64_t rng_state;
+
+static uint64_t rng(void)
+{
+    rng_state ^= rng_state >> 12;
+    rng_state ^= rng_state << 25;
+    rng_state ^= rng_state >> 27;
+    return rng_state * 0x2545f4914f6cdd1dull;
+}
+
+static unsigned int pick(const struct range *r)
+{
+    unsigned int n = r->min;
+
+    if (!r->mean) {
+        return r->min + rng() % (r->max - r->min + 1);
+    }
+    while (n < r->max && rng() % (r->mean - r->min + 1)) {
+        n++;
+    }
+    return n;
+}
+
+/* Letters and digits, with the odd hyphen where DNS allows one */
+static size_t random_label(char *out, unsigned int len)
+{
+    static const char alphabet[] = "abcdefghijklmnopqrstuvwxyz0123456789";
+    unsigned int i;
+
+    for (i = 0; i < len; i++) {
+        out[i] = i && i + 1 < len && rng() % 16 == 0 ? '-' : alphabet[rng() % (sizeof(alphabet) - 1)];
+    }
+    return len;
+}
+
+/* One or two substitutions, insertions, deletions or swaps of neighbours */
+static size_t typo_label(char *out, const char *kw, size_t len)
+{
+    static const char alphabet[] = "abcdefghijklmnopqrstuvwxyz0123456789";
+    unsigned int edits = 1 + rng() % 2;
+    size_t pos;
+    char tmp;
+
+    memcpy(out, kw, len);
+    while (edits--) {
+        pos = len ? rng() % len : 0;
+        switch (len ? rng() % 4 : 1) {
+        case 0:
+            out[pos] = alphabet[rng() % (sizeof(alphabet) - 1)];
+            break;
+        case 1:
+            if (len < LABEL_MAX) {
+                memmove(out + pos + 1, out + pos, len - pos);
+                out[pos] = alphabet[rng() % (sizeof(alphabet) - 1)];
+                len++;
+            }
+            break;
+        case 2:
+            if (len > 1) {
+                memmove(out + pos, out + pos + 1, len - pos - 1);
+                len--;
+            }
+            break;
+        default:
+            if (pos + 1 < len) {
+                tmp = out[pos];
+                out[pos] = out[pos + 1];
+                out[pos + 1] = tmp;
+            }
+            break;
+        }
+    }
+    return len;
+}
+
+/* Keywords the way typosee reads them: one per line, lower-cased, blank lines skipped */
+static char **load_keywords(const char *name, unsigned int *count)
+{
+    char buf[2048], **words = NULL, *p;
+    unsigned int cap = 0;
+    size_t len;
+    FILE *fp;
+
+    if ((fp = fopen(name, "r")) == NULL) {
+        die("unable to open the keyword file");
+    }
+    *count = 0;
+    while (fgets(buf, sizeof(buf), fp) != NULL) {
+        for (len = strlen(buf); len && (buf[len - 1] == '\n' || buf[len - 1] == '\r' || buf[len - 1] == ','); len--)
+            ;
+        if (!len || len > LABEL_MAX) {
+            continue;
+        }
+        buf[len] = 0x0;
+        for (p = buf; *p; p++) {
+            *p = tolower((unsigned char)*p);
+        }
+        if (*count == cap) {
+            cap = cap ? cap * 2 : 64;
+            if ((words = realloc(words, cap * sizeof(char *))) == NULL) {
+                die("Out of memory");
+            }
+        }
+        if ((words[(*count)++] = strdup(buf)) == NULL) {
+            die("Out of memory");
+        }
+    }
+    fclose(fp);
+    return words;
+}
+
+static unsigned int count_labels(const char *fqdn)
+{
+    unsigned int n = 1;
+
+    for (; *fqdn; fqdn++) {
+        n += *fqdn == '.';
+    }
+    return n;
+}
+
+static int parse_range(const char *s, struct range *r)
+{
+    int n;
+
+    r->mean = 0;
+    n = sscanf(s, "%u-%u,%u", &r->min, &r->max, &r->mean);
+    if (n == 1) {
+        r->max = r->min;
+    }
+    return n >= 1 && r->min >= 1 && r->max >= r->min && (!r->mean || (r->mean >= r->min && r->mean <= r->max));
+}
+
+static unsigned long long parse_size(const char *s)
+{
+    char *end;
+    unsigned long long n = strtoull(s, &end, 10);
+
+    switch (toupper((unsigned char)*end)) {
+    case 'T':
+        n <<= 10;
+        /* fall through */
+    case 'G':
+        n <<= 10;
+        /* fall through */
+    case 'M':
+        n <<= 10;
+        /* fall through */
+    case 'K':
+        n <<= 10;
+    }
+    return n;
+}
+
+int main(int argc, char **argv)
+{
+    static char recent[RECENT][FQDN_MAX + 1];
+    char fqdn[FQDN_MAX + 1], label[LABEL_MAX + 1];
+    const char *tld, *kw;
+    char **keywords = NULL;
+    struct range label_len = { 1, 20, 8 }, depth = { 0, 3, 0 };
+    unsigned int nkeywords = 0, typo_pct = 1, dup_pct = 10, i, d, labels, typo_at;
+    unsigned long long seed = 1, max_lines = ~0ull, max_bytes = ~0ull, row, bytes, typos = 0, dups = 0;
+    size_t len, n;
+
+    for (i = 1; i < (unsigned int)argc; i++) {
+        if (!strcmp(argv[i], "--seed") && i + 1 < (unsigned int)argc) {
+            seed = strtoull(argv[++i], NULL, 10);
+        }
+        else if (!strcmp(argv[i], "--lines") && i + 1 < (unsigned int)argc) {
+            max_lines = strtoull(argv[++i], NULL, 10);
+        }
+        else if (!strcmp(argv[i], "--size") && i + 1 < (unsigned int)argc) {
+            max_bytes = parse_size(argv[++i]);
+        }
+        else if (!strcmp(argv[i], "--keywords") && i + 1 < (unsigned int)argc) {
+            keywords = load_keywords(argv[++i], &nkeywords);
+        }
+        else if (!strcmp(argv[i], "--typos") && i + 1 < (unsigned int)argc) {
+            typo_pct = atoi(argv[++i]);
+        }
+        else if (!strcmp(argv[i], "--dups") && i + 1 < (unsigned int)argc) {
+            dup_pct = atoi(argv[++i]);
+        }
+        else if (!strcmp(argv[i], "--label-len") && i + 1 < (unsigned int)argc) {
+            if (!parse_range(argv[++i], &label_len) || label_len.max > LABEL_MAX) {
+                die("--label-len must be MIN-MAX or MIN-MAX,MEAN with 1 <= MIN <= MEAN <= MAX <= 63");
+            }
+        }
+        else if (!strcmp(argv[i], "--depth") && i + 1 < (unsigned int)argc) {
+            if (sscanf(argv[++i], "%u-%u", &depth.min, &depth.max) == 1) {
+                depth.max = depth.min;
+            }
+            if (depth.max < depth.min || depth.max > 8) {
+                die("--depth must be MIN-MAX with MIN <= MAX <= 8");
+            }
+        }
+        else {
+            printf("\ntyposee_gen - write a synthetic subdomain feed for typosee.\n\n\t");
+            printf("args: [--lines N] [--size B] [--seed S] [--keywords file [--typos P]] [--dups P] [--label-len MIN-MAX[,MEAN]]\n\t"
+                   "      [--depth MIN-MAX]\n\t"
+                   "where N=rows, B=bytes (K, M, G, T suffixes), P=percent of rows (typos default 1, dups default 10),\n\t"
+                   "label lengths default to 1-20,8 and the subdomain depth to 0-3 labels above the registered domain\n\n");
+            return 0;
+        }
+    }
+    if (max_lines == ~0ull && max_bytes == ~0ull) {
+        die("give --lines or --size");
+    }
+
+    rng_state = seed ? seed : 1;
+    setvbuf(stdout, NULL, _IOFBF, OUT_BUF);
+    bytes = printf("id,seq,labels,fqdn\n");
+
+    for (row = 0; row < max_lines && bytes < max_bytes; row++) {
+        if (row >= RECENT && rng() % 100 < dup_pct) {
+            memcpy(fqdn, recent[rng() % RECENT], sizeof(fqdn));
+            dups++;
+        }
+        else {
+            d = depth.min + rng() % (depth.max - depth.min + 1);
+            tld = tlds[rng() % NELEMS(tlds)];
+            typo_at = nkeywords && rng() % 100 < typo_pct ? rng() % (d + 1) : ~0u;
+            len = 0;
+            for (labels = 0; labels <= d; labels++) {
+                if (labels == typo_at) {
+                    kw = keywords[rng() % nkeywords];
+                    n = typo_label(label, kw, strlen(kw));
+                }
+                else {
+                    n = random_label(label, pick(&label_len));
+                }
+                if (len + n + 1 + strlen(tld) > FQDN_MAX) {
+                    break;
+                }
+                memcpy(fqdn + len, label, n);
+                len += n;
+                fqdn[len++] = '.';
+            }
+            if (labels > typo_at) {
+                typos++;
+            }
+            strcpy(fqdn + len, tld);
+            memcpy(recent[row % RECENT], fqdn, sizeof(fqdn));
+        }
+        bytes += printf("%llu,%llu,%u,%s\n", row + 1, row + 1, count_labels(fqdn), fqdn);
+    }
+
+    fflush(stdout);
+    if (ferror(stdout)) {
+        die("write error");
+    }
+    fprintf(stderr, "[GEN] %llu rows, %llu bytes, %llu with a typosquat, %llu duplicates\n", row, bytes, typos, dups);
+
+    for (i = 0; i < nkeywords; i++) {
+        free(keywords[i]);
+    }
+    free(keywords);
+    return 0;
+}
@@ -0,0 +1,271 @@
+/***************************/
+/* typosee_merge.c         */
+/*                         ***********************************************************************************************************/
+/* Combines the output of several `typosee ... --shard i/n` runs into the CSV a single unsharded run would have printed.              */
+/*                                                                                                                                   */
+/* Every shard starts with a "#shard,i,n,mode" line and ends with "#total,lines", and each of its rows is tagged with the keyword's  */
+/* index and the input offset of the line it came from. Without --ordered the shards are simply concatenated in shard order. With    */
+/* --ordered the rows are k-way merged on (keyword index, input offset), which is the order a serial run prints them in; that needs  */
+/* shards written in typosee's default ordered mode, not with --unordered. Debug (d) shards tag their trace and ReadLine lines too,  */
+/* so a merge puts them where a serial run prints them; untagged lines ahead of a shard's first row are passed through before the    */
+/* rows.                                                                                                                             */
+/*                                                                                                                                   */
+/* Trying it out on one box:                                                                                                         */
+/*                                                                                                                                   */
+/*     for i in 0 1 2 3; do ./typosee subs.csv keywords.txt 2 q --shard $i/4 > shard.$i & done; wait                                 */
+/*     ./typosee_merge --ordered shard.0 shard.1 shard.2 shard.3 > merged.csv                                                        */
+/*                                                                                                                                   */
+/* merged.csv then matches `./typosee subs.csv keywords.txt 2 q` line for line, "Total lines processed" included.                    */
+/* tests/shards.sh checks this on a synthetic feed, for v and d output and both ways of sharding.                                    */
+/*************************************************************************************************************************************/
+
+#define _GNU_SOURCE
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+
+/* One shard's output file and the record it is currently positioned on */
+struct shard {
+    const char *name;
+    FILE *fp;
+    unsigned int index;
+    unsigned int count;
+    char mode[16];
+    char header[128];                   /* column names, less the tag columns */
+    char *ahead;                        /* next unconsumed line, NULL at the trailer */
+    size_t ahead_cap;
+    char *rec;                          /* current row plus the verbose lines that follow it; at first the preamble */
+    size_t rec_len;
+    size_t rec_cap;
+    unsigned long long kw;
+    unsigned long long off;
+    int have_rec;
+    int have_total;
+    unsigned long long total;
+};
+
+static void die(const struct shard *s, const char *msg)
+{
+    fprintf(stderr, "[ERR]: %s%s%s\n", s ? s->name : "", s ? ": " : "", msg);
+    exit(1);
+}
+
+/* Reads the next line into s->ahead; handles the trailer and EOF */
+static void read_ahead(struct shard *s)
+{
+    if (getline(&s->ahead, &s->ahead_cap, s->fp) < 0) {
+        free(s->ahead);
+        s->ahead = NULL;
+        if (!s->have_total) {
+            die(s, "truncated shard output (no #total line)");
+        }
+        return;
+    }
+    if (!strncmp(s->ahead, "#total,", 7)) {
+        s->total = strtoull(s->ahead + 7, NULL, 10);
+        s->have_total = 1;
+        free(s->ahead);
+        s->ahead = NULL;
+    }
+}
+
+/* A tagged row starts with "<keyword index>,<input offset>," */
+static int parse_tag(const char *line, unsigned long long *kw, unsigned long long *off, const char **rest)
+{
+    char *end;
+
+    if (*line < '0' || *line > '9') {
+        return 0;
+    }
+    *kw = strtoull(line, &end, 10);
+    if (*end != ',' || end[1] < '0' || end[1] > '9') {
+        return 0;
+    }
+    *off = strtoull(end + 1, &end, 10);
+    if (*end != ',') {
+        return 0;
+    }
+    *rest = end + 1;
+    return 1;
+}
+
+static void rec_append(struct shard *s, const char *text)
+{
+    size_t len = strlen(text);
+
+    if (s->rec_len + len + 1 > s->rec_cap) {
+        s->rec_cap = (s->rec_len + len + 1) * 2;
+        if ((s->rec = realloc(s->rec, s->rec_cap)) == NULL) {
+            die(NULL, "Out of memory");
+        }
+    }
+    memcpy(s->rec + s->rec_len, text, len + 1);
+    s->rec_len += len;
+}
+
+/* Moves to the next row, collecting the untagged (verbose/debug) lines that belong to it */
+static void next_record(struct shard *s)
+{
+    unsigned long long kw, off;
+    const char *rest;
+
+    s->have_rec = 0;
+    s->rec_len = 0;
+    if (s->ahead == NULL) {
+        return;
+    }
+    if (!parse_tag(s->ahead, &kw, &off, &rest)) {
+        die(s, "expected a tagged row");
+    }
+    if (s->kw != ~0ull && (kw < s->kw || (kw == s->kw && off < s->off))) {
+        die(s, "rows are not in serial order; re-run the shard without --unordered");
+    }
+    s->kw = kw;
+    s->off = off;
+    s->have_rec = 1;
+    rec_append(s, rest);
+    for (read_ahead(s); s->ahead && !parse_tag(s->ahead, &kw, &off, &rest); read_ahead(s)) {
+        rec_append(s, s->ahead);
+    }
+}
+
+static void open_shard(struct shard *s, const char *name)
+{
+    unsigned long long kw, off;
+    const char *rest;
+
+    memset(s, 0, sizeof(*s));
+    s->name = name;
+    s->kw = ~0ull;
+    if ((s->fp = fopen(name, "r")) == NULL) {
+        die(s, "unable to open");
+    }
+    if (getline(&s->ahead, &s->ahead_cap, s->fp) < 0
+            || sscanf(s->ahead, "#shard,%u,%u,%15[a-z]", &s->index, &s->count, s->mode) != 3) {
+        die(s, "not typosee --shard output");
+    }
+    if (getline(&s->ahead, &s->ahead_cap, s->fp) < 0 || strncmp(s->ahead, "keyword-index,input-offset,", 27)) {
+        die(s, "truncated shard output (no header)");
+    }
+    snprintf(s->header, sizeof(s->header), "%s", s->ahead + 27);
+    /* Untagged lines ahead of the first row are kept as a preamble and passed through as they are */
+    for (read_ahead(s); s->ahead && !parse_tag(s->ahead, &kw, &off, &rest); read_ahead(s)) {
+        rec_append(s, s->ahead);
+    }
+}
+
+static int before(const struct shard *a, const struct shard *b)
+{
+    if (a->kw != b->kw) {
+        return a->kw < b->kw;
+    }
+    if (a->off != b->off) {
+        return a->off < b->off;
+    }
+    return a->index < b->index;
+}
+
+static void sift_down(struct shard **heap, unsigned int n, unsigned int i)
+{
+    unsigned int c;
+    struct shard *tmp;
+
+    while ((c = 2 * i + 1) < n) {
+        if (c + 1 < n && before(heap[c + 1], heap[c])) {
+            c++;
+        }
+        if (!before(heap[c], heap[i])) {
+            break;
+        }
+        tmp = heap[c];
+        heap[c] = heap[i];
+        heap[i] = tmp;
+        i = c;
+    }
+}
+
+static int by_index(const void *a, const void *b)
+{
+    const struct shard *x = a, *y = b;
+
+    return (x->index > y->index) - (x->index < y->index);
+}
+
+int main(int argc, char **argv)
+{
+    struct shard *shards, **heap;
+    unsigned int i, n = 0, live, ordered = 0;
+    unsigned long long total = 0;
+    int first = 1;
+
+    if (argc > 1 && !strcmp(argv[1], "--ordered")) {
+        ordered = 1;
+        first = 2;
+    }
+    if (argc <= first) {
+        printf("\ntyposee_merge - combine typosee --shard i/n outputs.\n\n\t");
+        printf("args: [--ordered] shard_output...  where --ordered restores the serial (keyword, line) order\n\n");
+        return 0;
+    }
+
+    if ((shards = calloc(argc - first, sizeof(*shards))) == NULL
+            || (heap = calloc(argc - first, sizeof(*heap))) == NULL) {
+        die(NULL, "Out of memory");
+    }
+    for (i = first; i < (unsigned int)argc; i++) {
+        open_shard(&shards[n++], argv[i]);
+    }
+
+    /* The shards must be exactly 0..n-1 of one n-way split */
+    qsort(shards, n, sizeof(*shards), by_index);
+    for (i = 0; i < n; i++) {
+        if (shards[i].count != n || shards[i].index != i || strcmp(shards[i].mode, shards[0].mode)
+                || strcmp(shards[i].header, shards[0].header)) {
+            fprintf(stderr, "[ERR]: expected shards 0..%u of one %u-way %s split; %s is shard %u/%u (%s)\n",
+                n - 1, n, shards[0].mode, shards[i].name, shards[i].index, shards[i].count, shards[i].mode);
+            return 1;
+        }
+    }
+
+    fputs(shards[0].header, stdout);    /* --substring runs add a column */
+
+    for (i = 0, live = 0; i < n; i++) {
+        if (shards[i].rec_len) {
+            fputs(shards[i].rec, stdout);
+        }
+        next_record(&shards[i]);
+        if (!ordered) {
+            while (shards[i].have_rec) {
+                fputs(shards[i].rec, stdout);
+                next_record(&shards[i]);
+            }
+        }
+        else if (shards[i].have_rec) {
+            heap[live++] = &shards[i];
+        }
+    }
+
+    for (i = live / 2; i-- > 0; ) {
+        sift_down(heap, live, i);
+    }
+    while (live) {
+        fputs(heap[0]->rec, stdout);
+        next_record(heap[0]);
+        if (!heap[0]->have_rec) {
+            heap[0] = heap[--live];
+        }
+        sift_down(heap, live, 0);
+    }
+
+    for (i = 0; i < n; i++) {
+        total += shards[i].total;
+        fclose(shards[i].fp);
+        free(shards[i].rec);
+    }
+    free(shards);
+    free(heap);
+
+    printf("Total lines processed: %llu\n", total);
+
+    return 0;
+}